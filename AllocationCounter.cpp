@@ -0,0 +1,134 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "AllocationCounter.h"
+
+#if defined _MSC_VER
+#  define ALLOCATION_THREAD_LOCAL __declspec(thread)
+#else
+#  define ALLOCATION_THREAD_LOCAL __thread
+#endif
+
+#ifdef NOTEDETECTOR_COUNT_ALLOCATIONS
+
+namespace {
+
+// shared by all the threads, so the allocations of the workers of parallel_for_ are counted as well
+std::atomic<long long> allocations(0);
+// set by AllocationExclusion, only for its own thread
+ALLOCATION_THREAD_LOCAL bool excluded = false;
+
+inline void count() {
+    if (!excluded) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Handler installed with std::set_new_handler (Visual Studio has std::get_new_handler from 2015 on)
+std::new_handler currentNewHandler() {
+#if defined _MSC_VER && _MSC_VER < 1900
+    std::new_handler handler = std::set_new_handler(NULL);
+    std::set_new_handler(handler);
+    return handler;
+#else
+    return std::get_new_handler();
+#endif
+}
+
+// Allocates as the operator new of the C++ library: while there is no memory, the new handler is called
+// to free some, and std::bad_alloc is thrown if there is no handler
+void* allocate(size_t size) {
+    count();
+    for (;;) {
+        void* memory = malloc(size > 0 ? size : 1);
+        if (memory != NULL) {
+            return memory;
+        }
+        std::new_handler handler = currentNewHandler();
+        if (handler == NULL) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* allocateNoThrow(size_t size) {
+    try {
+        return allocate(size);
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+}
+
+bool AllocationCounter::isEnabled() {
+    return true;
+}
+
+int64 AllocationCounter::getCount() {
+    return allocations.load();
+}
+
+AllocationExclusion::AllocationExclusion(void) {
+    was_excluded_ = excluded;
+    excluded = true;
+}
+
+AllocationExclusion::~AllocationExclusion(void) {
+    excluded = was_excluded_;
+}
+
+// the global operators replace the ones of the C++ library for the whole program
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+    return allocateNoThrow(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+    return allocateNoThrow(size);
+}
+
+void operator delete(void* memory) throw() {
+    free(memory);
+}
+
+void operator delete[](void* memory) throw() {
+    free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) throw() {
+    free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) throw() {
+    free(memory);
+}
+
+#else
+
+// Without NOTEDETECTOR_COUNT_ALLOCATIONS the operators of the C++ library are kept and nothing is counted
+
+bool AllocationCounter::isEnabled() {
+    return false;
+}
+
+int64 AllocationCounter::getCount() {
+    return 0;
+}
+
+AllocationExclusion::AllocationExclusion(void) {
+    was_excluded_ = false;
+}
+
+AllocationExclusion::~AllocationExclusion(void) {}
+
+#endif
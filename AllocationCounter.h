@@ -0,0 +1,27 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include "opencv2/core/core.hpp"
+
+// Counts the allocations made with operator new by all the threads, so the benchmark can check that
+// the detection doesn't allocate memory once its buffers have grown. The memory allocated by OpenCV with its
+// own allocator (the data of cv::Mat) or inside its libraries is not counted.
+// The global operator new and delete are only replaced when NOTEDETECTOR_COUNT_ALLOCATIONS is defined (the Debug
+// configuration); otherwise nothing is counted and getCount always returns 0.
+class AllocationCounter {
+public:
+    static bool isEnabled();
+    static int64 getCount();
+};
+
+// While it exists, the allocations of the current thread are not counted. It surrounds the calls to
+// the feature detectors and extractors of OpenCV, whose internal allocations the detection can't avoid.
+class AllocationExclusion {
+private:
+    bool was_excluded_;
+public:
+    AllocationExclusion(void);
+    ~AllocationExclusion(void);
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "BatchDetector.h"
+
+BatchDetector::BatchDetector(ObjectDetector& object_detector, int threads, int reduction) : object_detector_(object_detector) {
+    threads_ = threads > 0 ? threads : 1;
+    reduction_ = reduction;
+}
+
+BatchDetector::~BatchDetector(void) {}
+
+// Processes all the scenes, giving the notes found in each one to sink as soon as it is done
+void BatchDetector::run(const std::vector<std::string>& filenames, ResultSink& sink) {
+    std::atomic<int> next(0);
+
+    // each worker takes the next scene not yet processed until there are none left
+    std::vector<std::thread> workers;
+    int n_workers = std::min(threads_, (int) filenames.size());
+    for (int t = 0; t < n_workers; ++t) {
+        workers.push_back(std::thread([&]() {
+            // the scene and the buffers of the search are reused by all the scenes of the worker
+            ImgObject scene;
+            DetectionWorkspace workspace;
+            int i;
+            while ((i = next++) < (int) filenames.size()) {
+                if (scene.read(filenames[i], reduction_, object_detector_.hasColorFilter())) {
+                    object_detector_.computeScene(scene);
+                    sink.write(filenames[i], scene.getFullImg(), object_detector_.findAllObjects(scene, workspace, false));
+                } else {
+                    sink.writeError(filenames[i], "unable to read the image");
+                }
+            }
+        }));
+    }
+
+    for (unsigned int t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+}
+
+// Returns path with / as separator and without the leading ./, so that two names of the same file can be compared
+static std::string normalizePath(std::string path) {
+    std::replace(path.begin(), path.end(), '\\', '/');
+    while (path.compare(0, 2, "./") == 0) {
+        path.erase(0, 2);
+    }
+    return path;
+}
+
+// Returns the scene images given by path, which can be a directory, an image or
+// a text file (.txt or .lst) with one image filename per line.
+// The images of a directory whose name is in excluded (usually the reference images of the library) are skipped
+std::vector<std::string> BatchDetector::listScenes(std::string path, const std::vector<std::string>& excluded) {
+    std::vector<std::string> filenames;
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if (extension == "txt" || extension == "lst") {
+        std::ifstream file(path.c_str());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (!line.empty()) {
+                filenames.push_back(line);
+            }
+        }
+        return filenames;
+    }
+
+    std::vector<std::string> excluded_paths;
+    for (unsigned int i = 0; i < excluded.size(); ++i) {
+        excluded_paths.push_back(normalizePath(excluded[i]));
+    }
+
+    // if path is a directory, cv::glob lists all the files inside it
+    std::vector<std::string> files;
+    cv::glob(path, files);
+    for (unsigned int i = 0; i < files.size(); ++i) {
+        std::string file_extension = files[i].substr(files[i].find_last_of('.') + 1);
+        std::transform(file_extension.begin(), file_extension.end(), file_extension.begin(), ::tolower);
+        bool is_excluded = std::find(excluded_paths.begin(), excluded_paths.end(), normalizePath(files[i])) != excluded_paths.end();
+        if (!is_excluded && (file_extension == "jpg" || file_extension == "jpeg" || file_extension == "png" || file_extension == "bmp")) {
+            filenames.push_back(files[i]);
+        }
+    }
+    return filenames;
+}
+
+// Escapes the characters that can't appear inside a JSON string: the quotes, the backslashes
+// and all the control characters, which are written as \u00XX
+std::string BatchDetector::escapeJson(std::string text) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    std::string escaped;
+    for (unsigned int i = 0; i < text.size(); ++i) {
+        unsigned char c = (unsigned char) text[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += text[i];
+        } else if (c < 0x20) {
+            escaped += "\\u00";
+            escaped += HEX_DIGITS[c >> 4];
+            escaped += HEX_DIGITS[c & 0x0f];
+        } else {
+            escaped += text[i];
+        }
+    }
+    return escaped;
+}
+
+// Writes a number, or null when it is NaN or infinite, which JSON can't represent
+static void writeJsonNumber(std::ostream& out, float value) {
+    if (cvIsNaN(value) || cvIsInf(value)) {
+        out << "null";
+    } else {
+        out << value;
+    }
+}
+
+// Describes the notes found in a scene as a single line of JSON
+std::string BatchDetector::toJson(std::string scene_name, const std::vector<FoundObject>& objects_found) {
+    std::stringstream ss;
+    int total = 0;
+    ss << "{\"scene\":\"" << escapeJson(scene_name) << "\",\"notes\":[";
+    for (unsigned int i = 0; i < objects_found.size(); ++i) {
+        const FoundObject& found = objects_found[i];
+        total += found.value_;
+        ss << (i > 0 ? "," : "") << "{\"tag\":\"" << escapeJson(found.tag_) << "\",\"value\":" << found.value_ << ",\"contour\":[";
+        for (unsigned int j = 0; j < found.countour_.size(); ++j) {
+            ss << (j > 0 ? "," : "") << "[";
+            writeJsonNumber(ss, found.countour_[j].x);
+            ss << ",";
+            writeJsonNumber(ss, found.countour_[j].y);
+            ss << "]";
+        }
+        ss << "]}";
+    }
+    ss << "],\"total\":" << total << "}";
+    return ss.str();
+}
+
+// Describes a scene that couldn't be processed as a single line of JSON
+std::string BatchDetector::toErrorJson(std::string scene_name, std::string message) {
+    return "{\"scene\":\"" + escapeJson(scene_name) + "\",\"error\":\"" + escapeJson(message) + "\"}";
+}
@@ -0,0 +1,31 @@
+#ifndef BATCH_DETECTOR_H
+#define BATCH_DETECTOR_H
+
+#include <string>
+#include <vector>
+
+#include "ObjectDetector.h"
+#include "ResultSink.h"
+
+// Finds the notes in many scene images. The library of the given ObjectDetector must already be computed;
+// it is shared by all the worker threads, each one processing a different scene.
+// The scenes can be decoded with their sides divided by reduction (2, 4 or 8), which is much faster for large photos.
+class BatchDetector {
+private:
+    ObjectDetector& object_detector_;
+    int threads_;
+    int reduction_;
+public:
+    BatchDetector(ObjectDetector& object_detector, int threads, int reduction = 1);
+    ~BatchDetector(void);
+
+    void run(const std::vector<std::string>& filenames, ResultSink& sink);
+
+    static std::vector<std::string> listScenes(std::string path,
+                                               const std::vector<std::string>& excluded = std::vector<std::string>());
+    static std::string toJson(std::string scene_name, const std::vector<FoundObject>& objects_found);
+    static std::string toErrorJson(std::string scene_name, std::string message);
+    static std::string escapeJson(std::string text);
+};
+
+#endif
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "Benchmark.h"
+#include "AllocationCounter.h"
+#include "HammingMatcher.h"
+#include "Log.h"
+
+// Neighbours compared by compareMatchers, as many as the search of the notes uses
+#define COMPARED_NEIGHBOURS 2
+
+namespace {
+
+// Number of queries whose neighbours have different distances. The indices aren't compared,
+// since the matchers may break the ties between equally distant descriptors differently.
+int countMismatches(const std::vector<std::vector<cv::DMatch>>& expected, const std::vector<std::vector<cv::DMatch>>& found) {
+    if (expected.size() != found.size()) {
+        return (int) std::max(expected.size(), found.size());
+    }
+    int mismatches = 0;
+    for (unsigned int q = 0; q < expected.size(); ++q) {
+        bool same = expected[q].size() == found[q].size();
+        for (unsigned int j = 0; j < expected[q].size() && same; ++j) {
+            same = expected[q][j].distance == found[q][j].distance && expected[q][j].queryIdx == found[q][j].queryIdx;
+        }
+        if (!same) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Number of matches found by only one of the cross checking matchers. Both keep the first of equally distant
+// descriptors in each direction, so the indices are compared too.
+int countCrossCheckMismatches(const std::vector<cv::DMatch>& expected, const std::vector<cv::DMatch>& found) {
+    int mismatches = (int) std::max(expected.size(), found.size()) - (int) std::min(expected.size(), found.size());
+    for (unsigned int j = 0; j < std::min(expected.size(), found.size()); ++j) {
+        if (expected[j].queryIdx != found[j].queryIdx || expected[j].trainIdx != found[j].trainIdx ||
+            expected[j].distance != found[j].distance) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+}
+
+Benchmark::Benchmark(ObjectDetector& object_detector, int warmup, int repetitions, int reduction) : object_detector_(object_detector) {
+    reduction_ = reduction;
+    warmup_ = warmup > 0 ? warmup : 0;
+    repetitions_ = repetitions > 0 ? repetitions : 1;
+}
+
+Benchmark::~Benchmark(void) {}
+
+// Processes all the scenes with the combination of algorithms currently used by the detector.
+// Once warmed up, the search of the notes must not allocate memory when the matcher reuses its buffers:
+// returns false if it does. The features are computed by OpenCV, so their allocations are not counted.
+// The allocations are only checked when AllocationCounter is compiled in.
+bool Benchmark::run(std::string combination, const std::vector<std::string>& filenames) {
+    if (samples_.find(combination) == samples_.end()) {
+        combinations_.push_back(combination);
+        samples_[combination].resize(STAGE_COUNT + 3);
+    }
+    std::vector<std::vector<double>>& samples = samples_[combination];
+
+    // the scene and the buffers of the search are reused, as in the batch mode
+    ImgObject scene;
+    DetectionWorkspace workspace;
+    StageTimes stage_times;
+    bool allocation_free = true;
+    object_detector_.setStageTimes(&stage_times);
+    for (unsigned int i = 0; i < filenames.size(); ++i) {
+        for (int r = 0; r < warmup_ + repetitions_; ++r) {
+            stage_times.reset();
+            int64 allocations = AllocationCounter::getCount();
+            int64 begin = cv::getTickCount();
+            bool read;
+            {
+                ScopedStageTimer timer(&stage_times, STAGE_IMREAD);
+                read = scene.read(filenames[i], reduction_, object_detector_.hasColorFilter());
+            }
+            // scenes that can't be read are not measured
+            if (!read) {
+                break;
+            }
+            object_detector_.computeScene(scene);
+            int64 search_allocations = AllocationCounter::getCount();
+            object_detector_.findAllObjects(scene, workspace, false);
+            double total = (cv::getTickCount() - begin) * 1000.0 / cv::getTickFrequency();
+            search_allocations = AllocationCounter::getCount() - search_allocations;
+            allocations = AllocationCounter::getCount() - allocations;
+
+            if (r < warmup_) {
+                continue;
+            }
+            for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+                samples[stage].push_back(stage_times.getMilliseconds(stage));
+            }
+            samples[STAGE_COUNT].push_back(total);
+            samples[STAGE_COUNT + 1].push_back((double) allocations);
+            samples[STAGE_COUNT + 2].push_back((double) search_allocations);
+            if (search_allocations != 0 && object_detector_.hasReusableMatcher()) {
+                LOG_ERROR(combination << ": " << search_allocations << " allocations searching " << filenames[i] << "\n");
+                allocation_free = false;
+            }
+        }
+    }
+    object_detector_.setStageTimes(NULL);
+    return allocation_free;
+}
+
+// Name of the samples of a stage in the CSV
+std::string Benchmark::getSampleName(int stage) {
+    if (stage == STAGE_COUNT) {
+        return "total";
+    } else if (stage == STAGE_COUNT + 1) {
+        return "allocations";
+    } else if (stage == STAGE_COUNT + 2) {
+        return "search_allocations";
+    }
+    return StageTimes::getStageName(stage);
+}
+
+// Value below which are p percent of the samples (nearest rank)
+double Benchmark::percentile(const std::vector<double>& sorted_samples, double p) {
+    if (sorted_samples.empty()) {
+        return 0;
+    }
+    int rank = (int) std::ceil(p / 100 * sorted_samples.size());
+    return sorted_samples[std::max(rank, 1) - 1];
+}
+
+// Writes the statistics of each stage in milliseconds, one line per combination and stage.
+// When the allocations are counted, the last lines of each combination have the number of heap allocations made
+// while processing each scene, and while searching the notes in it.
+void Benchmark::writeCsv(std::ostream& output) {
+    int last_stage = AllocationCounter::isEnabled() ? STAGE_COUNT + 2 : STAGE_COUNT;
+    output << "combination,stage,samples,mean,median,p95,p99,max" << "\n";
+    for (unsigned int c = 0; c < combinations_.size(); ++c) {
+        std::vector<std::vector<double>>& samples = samples_[combinations_[c]];
+        for (int stage = 0; stage <= last_stage; ++stage) {
+            std::vector<double> sorted_samples = samples[stage];
+            std::sort(sorted_samples.begin(), sorted_samples.end());
+            double sum = 0;
+            for (unsigned int i = 0; i < sorted_samples.size(); ++i) {
+                sum += sorted_samples[i];
+            }
+            double mean = sorted_samples.empty() ? 0 : sum / sorted_samples.size();
+
+            output << combinations_[c] << "," << getSampleName(stage) << ","
+                   << sorted_samples.size() << std::fixed << std::setprecision(3)
+                   << "," << mean << "," << percentile(sorted_samples, 50) << "," << percentile(sorted_samples, 95)
+                   << "," << percentile(sorted_samples, 99) << "," << (sorted_samples.empty() ? 0 : sorted_samples.back()) << "\n";
+            output.unsetf(std::ios::floatfield);
+        }
+    }
+    output.flush();
+}
+
+// Checks that HammingMatcher finds the same nearest neighbours as cv::BFMatcher(NORM_HAMMING), with and without
+// masks, for each set of query descriptors against all the train descriptors, and the same nearest neighbour as
+// cv::BFMatcher(NORM_HAMMING, true) with cross check, and measures both. The milliseconds per query set are written
+// as CSV. Returns false if any neighbour differs.
+bool Benchmark::compareMatchers(const std::vector<cv::Mat>& train_descriptors, const std::vector<cv::Mat>& query_descriptors,
+                                int repetitions, std::ostream& output) {
+    cv::BFMatcher reference(cv::NORM_HAMMING);
+    HammingMatcher hamming;
+    reference.add(train_descriptors);
+    hamming.add(train_descriptors);
+
+    // every other group of 8 train descriptors is left out by the masks
+    std::vector<std::vector<cv::Mat>> masks(query_descriptors.size());
+    for (unsigned int i = 0; i < query_descriptors.size(); ++i) {
+        for (unsigned int j = 0; j < train_descriptors.size(); ++j) {
+            cv::Mat mask(query_descriptors[i].rows, train_descriptors[j].rows, CV_8U, cv::Scalar(0));
+            for (int t = 0; t < mask.cols; t += 16) {
+                mask.colRange(t, std::min(t + 8, mask.cols)).setTo(cv::Scalar(1));
+            }
+            masks[i].push_back(mask);
+        }
+    }
+
+    double reference_milliseconds = 0;
+    double hamming_milliseconds = 0;
+    int queries = 0;
+    int runs = 0;
+    int mismatches = 0;
+    std::vector<std::vector<cv::DMatch>> expected, found;
+    for (unsigned int i = 0; i < query_descriptors.size(); ++i) {
+        if (query_descriptors[i].empty()) {
+            continue;
+        }
+        queries += query_descriptors[i].rows;
+        for (int r = 0; r < repetitions; ++r) {
+            int64 begin = cv::getTickCount();
+            reference.knnMatch(query_descriptors[i], expected, COMPARED_NEIGHBOURS);
+            int64 middle = cv::getTickCount();
+            hamming.knnMatch(query_descriptors[i], found, COMPARED_NEIGHBOURS);
+            int64 end = cv::getTickCount();
+            reference_milliseconds += (middle - begin) * 1000.0 / cv::getTickFrequency();
+            hamming_milliseconds += (end - middle) * 1000.0 / cv::getTickFrequency();
+            ++runs;
+        }
+        mismatches += countMismatches(expected, found);
+
+        reference.knnMatch(query_descriptors[i], expected, COMPARED_NEIGHBOURS, masks[i]);
+        hamming.knnMatch(query_descriptors[i], found, COMPARED_NEIGHBOURS, masks[i]);
+        mismatches += countMismatches(expected, found);
+    }
+
+    // the nearest neighbour with cross check, as the Bruteforce combination matches each note, one train image
+    // at a time since BFMatcher only cross checks a single image
+    cv::BFMatcher cross_reference(cv::NORM_HAMMING, true);
+    HammingMatcher cross_hamming(true);
+    double cross_reference_milliseconds = 0;
+    double cross_hamming_milliseconds = 0;
+    int cross_runs = 0;
+    int cross_mismatches = 0;
+    std::vector<cv::DMatch> cross_expected, cross_found;
+    for (unsigned int i = 0; i < query_descriptors.size(); ++i) {
+        if (query_descriptors[i].empty()) {
+            continue;
+        }
+        for (int r = 0; r < repetitions; ++r) {
+            int64 begin = cv::getTickCount();
+            for (unsigned int j = 0; j < train_descriptors.size(); ++j) {
+                cross_reference.match(query_descriptors[i], train_descriptors[j], cross_expected);
+            }
+            int64 middle = cv::getTickCount();
+            for (unsigned int j = 0; j < train_descriptors.size(); ++j) {
+                cross_hamming.match(query_descriptors[i], train_descriptors[j], cross_found);
+            }
+            int64 end = cv::getTickCount();
+            cross_reference_milliseconds += (middle - begin) * 1000.0 / cv::getTickFrequency();
+            cross_hamming_milliseconds += (end - middle) * 1000.0 / cv::getTickFrequency();
+            ++cross_runs;
+        }
+        for (unsigned int j = 0; j < train_descriptors.size(); ++j) {
+            cross_reference.match(query_descriptors[i], train_descriptors[j], cross_expected);
+            cross_hamming.match(query_descriptors[i], train_descriptors[j], cross_found);
+            cross_mismatches += countCrossCheckMismatches(cross_expected, cross_found);
+        }
+    }
+
+    runs = std::max(runs, 1);
+    cross_runs = std::max(cross_runs, 1);
+    output << "matcher,kernel,query_sets,queries,milliseconds,mismatches" << "\n" << std::fixed << std::setprecision(3)
+           << "BFMatcher,," << query_descriptors.size() << "," << queries << "," << reference_milliseconds / runs << ",0" << "\n"
+           << "HammingMatcher," << HammingMatcher::getKernelName() << "," << query_descriptors.size() << "," << queries << ","
+           << hamming_milliseconds / runs << "," << mismatches << "\n"
+           << "BFMatcher cross check,," << query_descriptors.size() << "," << queries << ","
+           << cross_reference_milliseconds / cross_runs << ",0" << "\n"
+           << "HammingMatcher cross check," << HammingMatcher::getKernelName() << "," << query_descriptors.size() << ","
+           << queries << "," << cross_hamming_milliseconds / cross_runs << "," << cross_mismatches << "\n";
+    output.unsetf(std::ios::floatfield);
+    output.flush();
+    return mismatches == 0 && cross_mismatches == 0;
+}
@@ -0,0 +1,40 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ObjectDetector.h"
+#include "StageTimer.h"
+
+// Measures how long each stage of the detection takes for a set of scenes. Each scene is processed a few times
+// without being measured, to warm up the caches and the buffers of the search, and then the given number of repetitions.
+// The library of the ObjectDetector must already be computed with the combination being measured.
+class Benchmark {
+private:
+    ObjectDetector& object_detector_;
+    int warmup_;
+    int repetitions_;
+    int reduction_;
+
+    // milliseconds of each repetition, by combination and stage (STAGE_COUNT is the total),
+    // the number of allocations of each repetition (STAGE_COUNT + 1) and those of the search alone (STAGE_COUNT + 2)
+    std::vector<std::string> combinations_;
+    std::map<std::string, std::vector<std::vector<double>>> samples_;
+
+    static double percentile(const std::vector<double>& sorted_samples, double p);
+    static std::string getSampleName(int stage);
+public:
+    Benchmark(ObjectDetector& object_detector, int warmup = 1, int repetitions = 5, int reduction = 1);
+    ~Benchmark(void);
+
+    bool run(std::string combination, const std::vector<std::string>& filenames);
+    void writeCsv(std::ostream& output);
+
+    static bool compareMatchers(const std::vector<cv::Mat>& train_descriptors, const std::vector<cv::Mat>& query_descriptors,
+                                int repetitions, std::ostream& output);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ColorSignature.h"
+
+// Pixels darker than this value have no reliable hue
+#define MIN_VALUE 40
+// Pixels less saturated than this are counted as grey
+#define MIN_SATURATION 50
+// Part of the signature of a note that must be found in a scene for the note to be searched
+#define MIN_EXPLAINED 0.5
+
+ColorSignature::ColorSignature(void) : empty_(true) {
+    std::fill(bins_, bins_ + COLOR_SIGNATURE_BINS, 0.0f);
+}
+
+ColorSignature::~ColorSignature(void) {}
+
+// Computes the signature of an image in BGR. The image should already be reduced, since every pixel is counted.
+void ColorSignature::compute(const cv::Mat& color) {
+    std::fill(bins_, bins_ + COLOR_SIGNATURE_BINS, 0.0f);
+    empty_ = true;
+    if (color.empty() || color.type() != CV_8UC3) {
+        return;
+    }
+
+    cv::Mat hsv;
+    cv::cvtColor(color, hsv, CV_BGR2HSV);
+    int counted = 0;
+    for (int y = 0; y < hsv.rows; ++y) {
+        const uchar* pixel = hsv.ptr<uchar>(y);
+        for (int x = 0; x < hsv.cols; ++x, pixel += 3) {
+            if (pixel[2] < MIN_VALUE) {
+                continue;
+            }
+            // the hue of OpenCV goes from 0 to 179, so each bin has 10 values
+            int bin = pixel[1] < MIN_SATURATION ? COLOR_SIGNATURE_HUES : std::min(pixel[0] / 10, COLOR_SIGNATURE_HUES - 1);
+            bins_[bin] += 1;
+            ++counted;
+        }
+    }
+    if (counted == 0) {
+        return;
+    }
+    for (int i = 0; i < COLOR_SIGNATURE_BINS; ++i) {
+        bins_[i] /= counted;
+    }
+    empty_ = false;
+}
+
+bool ColorSignature::empty() const {
+    return empty_;
+}
+
+// Checks if a note with this signature could be in a scene with the given signature, if it covered at least
+// min_area of the scene: then each color of the note is at least min_area times as frequent in the scene.
+// Neighbouring hues are accepted, since the hue changes with the light. An empty signature is always plausible.
+bool ColorSignature::isPlausibleIn(const ColorSignature& scene, double min_area) const {
+    if (empty_ || scene.empty_) {
+        return true;
+    }
+
+    double explained = 0;
+    for (int i = 0; i < COLOR_SIGNATURE_HUES; ++i) {
+        float previous = scene.bins_[(i + COLOR_SIGNATURE_HUES - 1) % COLOR_SIGNATURE_HUES];
+        float next = scene.bins_[(i + 1) % COLOR_SIGNATURE_HUES];
+        float in_scene = std::max(scene.bins_[i], std::max(previous, next));
+        explained += std::min((double) bins_[i], in_scene / min_area);
+    }
+    explained += std::min((double) bins_[COLOR_SIGNATURE_HUES], scene.bins_[COLOR_SIGNATURE_HUES] / min_area);
+    return explained >= MIN_EXPLAINED;
+}
@@ -0,0 +1,26 @@
+#ifndef COLOR_SIGNATURE_H
+#define COLOR_SIGNATURE_H
+
+#include "opencv2/core/core.hpp"
+
+// Number of hue bins of a signature, 10 degrees each. The last bin of the signature counts the grey pixels.
+#define COLOR_SIGNATURE_HUES 18
+#define COLOR_SIGNATURE_BINS (COLOR_SIGNATURE_HUES + 1)
+
+// Hue histogram of a low resolution color image, normalized to add up to 1. Dark pixels have no reliable hue
+// and are not counted. The euro notes are told apart by their dominant hue (5 grey, 10 red, 20 blue, 50 orange...),
+// so a note whose colors are missing from a scene doesn't need to be searched in it.
+class ColorSignature {
+private:
+    float bins_[COLOR_SIGNATURE_BINS];
+    bool empty_;
+public:
+    ColorSignature(void);
+    ~ColorSignature(void);
+
+    void compute(const cv::Mat& color);
+    bool empty() const;
+    bool isPlausibleIn(const ColorSignature& scene, double min_area) const;
+};
+
+#endif
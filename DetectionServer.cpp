@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined _WIN32
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+typedef int socklen_t;
+#  define SHUT_RDWR SD_BOTH
+#else
+#  include <arpa/inet.h>
+#  include <netinet/in.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+typedef int SOCKET;
+#  define INVALID_SOCKET (-1)
+#  define SOCKET_ERROR (-1)
+#  define closesocket close
+#endif
+
+#include "DetectionServer.h"
+#include "BatchDetector.h"
+#include "Metrics.h"
+
+#include "Log.h"
+
+// Largest request accepted, including the image
+#define MAX_REQUEST_SIZE (32 << 20)
+// Seconds a worker waits for a slow client before closing its connection
+#define CLIENT_TIMEOUT 10
+// Milliseconds waited after accept fails (too many open files...), so the loop doesn't spin until it recovers
+#define ACCEPT_RETRY_DELAY 100
+
+namespace {
+
+void setTimeout(SOCKET client, int seconds) {
+#if defined _WIN32
+    DWORD timeout = seconds * 1000;
+#else
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+#endif
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*) &timeout, sizeof(timeout));
+}
+
+void sendAll(SOCKET client, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(client, data.data() + sent, (int) (data.size() - sent), 0);
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+}
+
+void sendResponse(SOCKET client, int status, std::string content_type, const std::string& body) {
+    const char* reason = "OK";
+    switch (status) {
+    case 400: reason = "Bad Request"; break;
+    case 404: reason = "Not Found"; break;
+    case 405: reason = "Method Not Allowed"; break;
+    case 411: reason = "Length Required"; break;
+    case 413: reason = "Payload Too Large"; break;
+    case 503: reason = "Service Unavailable"; break;
+    }
+    std::stringstream ss;
+    ss << "HTTP/1.1 " << status << " " << reason << "\r\n"
+       << "Content-Type: " << content_type << "\r\n"
+       << "Content-Length: " << body.size() << "\r\n"
+       << "Connection: close\r\n\r\n";
+    sendAll(client, ss.str() + body);
+}
+
+// Code of the last error of a socket call
+int socketError() {
+#if defined _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+std::string errorJson(std::string message) {
+    return "{\"error\":\"" + BatchDetector::escapeJson(message) + "\"}";
+}
+
+// Decodes the %XX and + of a query string value
+std::string urlDecode(const std::string& text) {
+    std::string decoded;
+    for (unsigned int i = 0; i < text.size(); ++i) {
+        if (text[i] == '%' && i + 2 < text.size()) {
+            decoded += (char) strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+            i += 2;
+        } else if (text[i] == '+') {
+            decoded += ' ';
+        } else {
+            decoded += text[i];
+        }
+    }
+    return decoded;
+}
+
+// Value of a parameter in the query string of a target such as /detect?path=a.jpg
+std::string getParameter(const std::string& target, std::string name) {
+    size_t query = target.find('?');
+    while (query != std::string::npos) {
+        size_t end = target.find('&', query + 1);
+        std::string parameter = target.substr(query + 1, end == std::string::npos ? std::string::npos : end - query - 1);
+        if (parameter.compare(0, name.size() + 1, name + "=") == 0) {
+            return urlDecode(parameter.substr(name.size() + 1));
+        }
+        query = end;
+    }
+    return "";
+}
+
+}
+
+DetectionServer::DetectionServer(ObjectDetector& object_detector, int port, int threads, int max_queue, int reduction) :
+    object_detector_(object_detector), running_(false), listen_socket_((long long) INVALID_SOCKET) {
+    port_ = port;
+    threads_ = threads > 0 ? threads : 1;
+    max_queue_ = max_queue > 0 ? max_queue : 1;
+    reduction_ = reduction;
+}
+
+DetectionServer::~DetectionServer(void) {}
+
+// Serves requests until stop is called. Returns false if the port can't be used.
+bool DetectionServer::run() {
+#if defined _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        LOG_ERROR("Unable to initialize Winsock\n");
+        return false;
+    }
+#endif
+
+    SOCKET listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short) port_);
+    int reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+    if (listen_socket == INVALID_SOCKET || bind(listen_socket, (sockaddr*) &address, sizeof(address)) == SOCKET_ERROR
+        || listen(listen_socket, SOMAXCONN) == SOCKET_ERROR) {
+        LOG_ERROR("Unable to listen on port " << port_ << "\n");
+        if (listen_socket != INVALID_SOCKET) {
+            closesocket(listen_socket);
+        }
+        return false;
+    }
+    listen_socket_ = (long long) listen_socket;
+    running_ = true;
+    LOG_INFO("Listening on 127.0.0.1:" << port_ << "\n");
+
+    Counter* rejected = Metrics::instance().counter("notedetector_server_rejected_total", "Connections rejected because the queue was full");
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads_; ++t) {
+        workers.push_back(std::thread(&DetectionServer::worker, this));
+    }
+
+    while (running_) {
+        SOCKET client = accept(listen_socket, NULL, NULL);
+        if (client == INVALID_SOCKET) {
+            // stop closes the socket to make accept return
+            if (running_) {
+                LOG_ERROR("Unable to accept a connection (error " << socketError() << ")\n");
+                std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_RETRY_DELAY));
+            }
+            continue;
+        }
+        setTimeout(client, CLIENT_TIMEOUT);
+
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if ((int) queue_.size() >= max_queue_) {
+            lock.unlock();
+            // the server is busy: the client is told to retry instead of waiting without limit
+            rejected->increment();
+            sendResponse(client, 503, "application/json", errorJson("busy"));
+            closesocket(client);
+            continue;
+        }
+        queue_.push_back((long long) client);
+        lock.unlock();
+        queue_not_empty_.notify_one();
+    }
+
+    // the workers are woken up here instead of in stop, which can be called from a signal handler.
+    // The lock makes sure no worker misses the notification between checking running_ and waiting
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_not_empty_.notify_all();
+    }
+    for (unsigned int t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+#if defined _WIN32
+    WSACleanup();
+#endif
+    return true;
+}
+
+// Stops accepting connections, making run return once the connections already accepted are answered.
+// Only uses atomics and socket calls, so it can be called from a signal handler.
+void DetectionServer::stop() {
+    running_ = false;
+    SOCKET listen_socket = (SOCKET) listen_socket_.exchange((long long) INVALID_SOCKET);
+    if (listen_socket != INVALID_SOCKET) {
+        // wakes up the accept of run
+        shutdown(listen_socket, SHUT_RDWR);
+        closesocket(listen_socket);
+    }
+}
+
+void DetectionServer::worker() {
+    // the scene and the buffers of the search are reused by all the requests of the worker
+    ImgObject scene;
+    DetectionWorkspace workspace;
+    while (true) {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        while (queue_.empty() && running_) {
+            queue_not_empty_.wait(lock);
+        }
+        if (queue_.empty()) {
+            return;
+        }
+        long long client = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+
+        handle(client, scene, workspace);
+        closesocket((SOCKET) client);
+    }
+}
+
+// Reads a request and sends its response
+void DetectionServer::handle(long long client_handle, ImgObject& scene, DetectionWorkspace& workspace) {
+    SOCKET client = (SOCKET) client_handle;
+    std::string request;
+    char buffer[1 << 16];
+
+    // the headers end with an empty line
+    size_t header_end;
+    while ((header_end = request.find("\r\n\r\n")) == std::string::npos) {
+        int n = recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0 || request.size() > MAX_REQUEST_SIZE) {
+            return;
+        }
+        request.append(buffer, n);
+    }
+
+    std::stringstream request_line(request.substr(0, request.find("\r\n")));
+    std::string method, target;
+    request_line >> method >> target;
+
+    size_t content_length = 0;
+    bool chunked = false;
+    bool expect_continue = false;
+    std::string headers = request.substr(0, header_end);
+    for (size_t line = headers.find("\r\n"); line != std::string::npos; line = headers.find("\r\n", line + 2)) {
+        std::string header = headers.substr(line + 2, headers.find("\r\n", line + 2) - line - 2);
+        std::string name = header.substr(0, header.find(':'));
+        for (unsigned int i = 0; i < name.size(); ++i) {
+            name[i] = (char) tolower(name[i]);
+        }
+        std::string value = header.substr(header.find(':') + 1);
+        for (unsigned int i = 0; i < value.size(); ++i) {
+            value[i] = (char) tolower(value[i]);
+        }
+        if (name == "content-length") {
+            content_length = (size_t) strtoul(value.c_str(), NULL, 10);
+        } else if (name == "transfer-encoding") {
+            chunked = value.find("chunked") != std::string::npos;
+        } else if (name == "expect") {
+            expect_continue = value.find("100-continue") != std::string::npos;
+        }
+    }
+    // the chunked bodies are not decoded: the clients must send the length of the image
+    if (chunked) {
+        sendResponse(client, 411, "application/json", errorJson("chunked requests are not supported, send a Content-Length"));
+        return;
+    }
+    if (content_length > MAX_REQUEST_SIZE) {
+        sendResponse(client, 413, "application/json", errorJson("request too large"));
+        return;
+    }
+
+    std::string body = request.substr(header_end + 4);
+    // clients such as curl wait for it before sending a large body
+    if (expect_continue && content_length > 0 && body.size() < content_length) {
+        sendAll(client, "HTTP/1.1 100 Continue\r\n\r\n");
+    }
+    while (body.size() < content_length) {
+        int n = recv(client, buffer, (int) std::min(sizeof(buffer), content_length - body.size()), 0);
+        if (n <= 0) {
+            return;
+        }
+        body.append(buffer, n);
+    }
+
+    std::string path = target.substr(0, target.find('?'));
+    if (path == "/health") {
+        sendResponse(client, 200, "application/json", "{\"status\":\"ok\"}");
+    } else if (path == "/metrics") {
+        std::stringstream ss;
+        Metrics::instance().writePrometheus(ss);
+        sendResponse(client, 200, "text/plain; version=0.0.4", ss.str());
+    } else if (path == "/detect") {
+        if (method != "GET" && method != "POST") {
+            sendResponse(client, 405, "application/json", errorJson("use GET or POST"));
+            return;
+        }
+        int status;
+        std::string json = detect(getParameter(target, "path"), method == "POST" ? body : "", scene, workspace, status);
+        sendResponse(client, status, "application/json", json);
+    } else {
+        sendResponse(client, 404, "application/json", errorJson("not found"));
+    }
+}
+
+// Finds the notes in the image file given by path, or else in the encoded image in body,
+// which is read into scene. Returns the JSON response and its HTTP status.
+std::string DetectionServer::detect(const std::string& path, const std::string& body, ImgObject& scene, DetectionWorkspace& workspace, int& status) {
+    std::string scene_name = path;
+    bool read;
+    if (!path.empty()) {
+        read = scene.read(path, reduction_, object_detector_.hasColorFilter());
+    } else if (!body.empty()) {
+        // the image is decoded directly from the request
+        scene_name = "request";
+        read = scene.decode((const uchar*) body.data(), body.size(), reduction_, object_detector_.hasColorFilter());
+    } else {
+        status = 400;
+        return errorJson("no path or image given");
+    }
+    if (!read) {
+        status = 400;
+        return errorJson("unable to read the image");
+    }
+
+    object_detector_.computeScene(scene);
+    std::vector<FoundObject>& objects_found = object_detector_.findAllObjects(scene, workspace, false);
+    status = 200;
+    return BatchDetector::toJson(scene_name, objects_found);
+}
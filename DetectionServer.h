@@ -0,0 +1,46 @@
+#ifndef DETECTION_SERVER_H
+#define DETECTION_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "ObjectDetector.h"
+
+// Finds notes in the scenes sent to a local HTTP endpoint, keeping the library of the given ObjectDetector
+// (which must already be computed) loaded between requests. Only connections from the same machine are accepted.
+//   GET  /health                   status of the server
+//   GET  /metrics                  metrics in the Prometheus text format
+//   GET  /detect?path=<filename>   notes found in an image file, as JSON
+//   POST /detect                   notes found in the encoded image (jpg, png, ...) sent in the body
+// The connections are handled by a pool of workers, each one reusing its own scene and search buffers.
+// When the queue of waiting connections is full, new ones are answered with 503 so the clients can retry later.
+class DetectionServer {
+private:
+    ObjectDetector& object_detector_;
+    int port_;
+    int threads_;
+    int max_queue_;
+    int reduction_;
+
+    // sockets are kept as integers, so the socket headers are only included by the implementation
+    std::deque<long long> queue_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_not_empty_;
+    std::atomic<bool> running_;
+    std::atomic<long long> listen_socket_;
+
+    void worker();
+    void handle(long long client, ImgObject& scene, DetectionWorkspace& workspace);
+    std::string detect(const std::string& path, const std::string& body, ImgObject& scene, DetectionWorkspace& workspace, int& status);
+public:
+    DetectionServer(ObjectDetector& object_detector, int port, int threads, int max_queue = 64, int reduction = 1);
+    ~DetectionServer(void);
+
+    bool run();
+    void stop();
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <cstdlib>
+#include <iomanip>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "Evaluator.h"
+
+#include "Log.h"
+
+double Evaluation::precision() const {
+    int found = true_positives_ + false_positives_;
+    return found == 0 ? 1 : (double) true_positives_ / found;
+}
+
+double Evaluation::recall() const {
+    int expected = true_positives_ + false_negatives_;
+    return expected == 0 ? 1 : (double) true_positives_ / expected;
+}
+
+Evaluator::Evaluator(void) {}
+
+Evaluator::~Evaluator(void) {}
+
+// Reads the annotated scenes. Returns false if the file can't be read or has no scenes.
+bool Evaluator::loadAnnotations(std::string filename) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+
+    std::string directory;
+    size_t separator = filename.find_last_of("/\\");
+    if (separator != std::string::npos) {
+        directory = filename.substr(0, separator + 1);
+    }
+
+    filenames_.clear();
+    annotations_.clear();
+    cv::FileNode scenes = fs["scenes"];
+    for (cv::FileNodeIterator it = scenes.begin(); it != scenes.end(); ++it) {
+        std::string scene_filename = (std::string) (*it)["filename"];
+        if (scene_filename.empty()) {
+            continue;
+        }
+
+        std::vector<Annotation> scene_annotations;
+        cv::FileNode notes = (*it)["notes"];
+        for (cv::FileNodeIterator note = notes.begin(); note != notes.end(); ++note) {
+            std::vector<float> coordinates;
+            (*note)["quad"] >> coordinates;
+            std::vector<cv::Point2f> quad;
+            for (unsigned int i = 0; i + 1 < coordinates.size(); i += 2) {
+                quad.push_back(cv::Point2f(coordinates[i], coordinates[i + 1]));
+            }
+            scene_annotations.push_back(Annotation((std::string) (*note)["tag"], (int) (*note)["value"], quad));
+        }
+
+        filenames_.push_back(directory + scene_filename);
+        annotations_.push_back(scene_annotations);
+    }
+    return !filenames_.empty();
+}
+
+int Evaluator::getSceneCount() {
+    return (int) filenames_.size();
+}
+
+// Tags of the given notes that no annotated scene has. A combination selected on scenes that don't have
+// every note, on both sides, may be too inaccurate for the missing ones.
+std::vector<std::string> Evaluator::findUnannotated(const std::vector<std::string>& tags) {
+    std::vector<std::string> unannotated;
+    for (unsigned int t = 0; t < tags.size(); ++t) {
+        bool annotated = false;
+        for (unsigned int i = 0; i < annotations_.size() && !annotated; ++i) {
+            for (unsigned int j = 0; j < annotations_[i].size() && !annotated; ++j) {
+                annotated = annotations_[i][j].tag_ == tags[t];
+            }
+        }
+        if (!annotated) {
+            unannotated.push_back(tags[t]);
+        }
+    }
+    return unannotated;
+}
+
+// A note found corresponds to an annotation if it's the same note and its center is inside the annotated quad
+bool Evaluator::matches(const FoundObject& found_object, const Annotation& annotation) {
+    if (found_object.tag_ != annotation.tag_) {
+        return false;
+    }
+    if (annotation.quad_.size() < 3) {
+        return true;
+    }
+
+    cv::Point2f center(0, 0);
+    for (unsigned int i = 0; i < found_object.countour_.size(); ++i) {
+        center += found_object.countour_[i];
+    }
+    center *= 1.0f / found_object.countour_.size();
+    return cv::pointPolygonTest(annotation.quad_, center, false) >= 0;
+}
+
+// Finds the notes in all the annotated scenes with the combination of algorithms currently used by the detector
+Evaluation Evaluator::evaluate(ObjectDetector& object_detector, std::string combination) {
+    Evaluation evaluation(combination);
+    double total_ms = 0;
+    double total_value_error = 0;
+
+    for (unsigned int i = 0; i < filenames_.size(); ++i) {
+        // the notes of a scene that can't be read are all missed
+        std::vector<FoundObject> objects_found;
+        ImgObject scene;
+        int64 begin = cv::getTickCount();
+        if (scene.read(filenames_[i], 1, object_detector.hasColorFilter())) {
+            object_detector.computeScene(scene);
+            objects_found = object_detector.findAllObjects(scene, false);
+        }
+        total_ms += (cv::getTickCount() - begin) * 1000.0 / cv::getTickFrequency();
+
+        // each annotation can only be matched by one of the notes found
+        std::vector<Annotation>& expected = annotations_[i];
+        std::vector<bool> matched(expected.size(), false);
+        int found_value = 0;
+        int expected_value = 0;
+        for (unsigned int j = 0; j < objects_found.size(); ++j) {
+            found_value += objects_found[j].value_;
+            bool true_positive = false;
+            for (unsigned int k = 0; k < expected.size() && !true_positive; ++k) {
+                if (!matched[k] && matches(objects_found[j], expected[k])) {
+                    matched[k] = true;
+                    true_positive = true;
+                }
+            }
+            if (true_positive) {
+                ++evaluation.true_positives_;
+            } else {
+                ++evaluation.false_positives_;
+            }
+        }
+        for (unsigned int k = 0; k < expected.size(); ++k) {
+            expected_value += expected[k].value_;
+            if (!matched[k]) {
+                ++evaluation.false_negatives_;
+            }
+        }
+        total_value_error += std::abs(found_value - expected_value);
+    }
+
+    if (!filenames_.empty()) {
+        evaluation.latency_ = total_ms / filenames_.size();
+        evaluation.value_error_ = total_value_error / filenames_.size();
+    }
+    return evaluation;
+}
+
+void Evaluator::writeCsv(const std::vector<Evaluation>& evaluations, std::ostream& output) {
+    output << "combination,true_positives,false_positives,false_negatives,precision,recall,value_error,latency_ms" << "\n";
+    for (unsigned int i = 0; i < evaluations.size(); ++i) {
+        const Evaluation& evaluation = evaluations[i];
+        output << evaluation.combination_ << "," << evaluation.true_positives_ << "," << evaluation.false_positives_
+               << "," << evaluation.false_negatives_ << std::fixed << std::setprecision(3)
+               << "," << evaluation.precision() << "," << evaluation.recall()
+               << "," << evaluation.value_error_ << "," << evaluation.latency_ << "\n";
+        output.unsetf(std::ios::floatfield);
+    }
+    output.flush();
+}
+
+// Index of the fastest combination whose precision and recall are at least the given ones, or -1 if none is
+int Evaluator::selectFastest(const std::vector<Evaluation>& evaluations, double min_precision, double min_recall) {
+    int fastest = -1;
+    for (unsigned int i = 0; i < evaluations.size(); ++i) {
+        if (evaluations[i].precision() < min_precision || evaluations[i].recall() < min_recall) {
+            continue;
+        }
+        if (fastest == -1 || evaluations[i].latency_ < evaluations[fastest].latency_) {
+            fastest = i;
+        }
+    }
+    return fastest;
+}
+
+// Saves the selected combination, to be used by default in the next runs
+bool Evaluator::saveSelection(std::string filename, int combination) {
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        LOG_ERROR("Unable to write " << filename << "\n");
+        return false;
+    }
+    fs << "combination" << combination;
+    return true;
+}
+
+// Reads the combination saved by saveSelection, or returns default_combination if there is none
+int Evaluator::loadSelection(std::string filename, int default_combination) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened() || fs["combination"].empty()) {
+        return default_combination;
+    }
+    return (int) fs["combination"];
+}
@@ -0,0 +1,62 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "ObjectDetector.h"
+
+// A note expected in a scene. The quad is approximate; if it's empty only the tag is checked.
+struct Annotation {
+    Annotation(std::string tag, int value, std::vector<cv::Point2f> quad) : tag_(tag), value_(value), quad_(quad) {};
+    std::string tag_;
+    int value_;
+    std::vector<cv::Point2f> quad_;
+};
+
+// Accuracy and latency of a combination of algorithms over all the annotated scenes
+struct Evaluation {
+    Evaluation(std::string combination) : combination_(combination), true_positives_(0), false_positives_(0),
+        false_negatives_(0), value_error_(0), latency_(0) {};
+    std::string combination_;
+    int true_positives_;
+    int false_positives_;
+    int false_negatives_;
+    double value_error_; // mean absolute difference between the total found and expected in each scene
+    double latency_;     // mean milliseconds per scene
+
+    double precision() const;
+    double recall() const;
+};
+
+// Compares the notes found by an ObjectDetector with the annotations of a set of scenes.
+// The annotations file is read with cv::FileStorage, with the scene filenames relative to its directory:
+//   scenes:
+//     - filename: "IMG_2664.JPG"
+//       notes:
+//         - { tag: "50F", value: 50, quad: [ 98, 83, 512, 128, 495, 372, 45, 310 ] }
+class Evaluator {
+private:
+    std::vector<std::string> filenames_;
+    std::vector<std::vector<Annotation>> annotations_;
+
+    static bool matches(const FoundObject& found_object, const Annotation& annotation);
+public:
+    Evaluator(void);
+    ~Evaluator(void);
+
+    bool loadAnnotations(std::string filename);
+    int getSceneCount();
+    std::vector<std::string> findUnannotated(const std::vector<std::string>& tags);
+    Evaluation evaluate(ObjectDetector& object_detector, std::string combination);
+
+    static void writeCsv(const std::vector<Evaluation>& evaluations, std::ostream& output);
+    static int selectFastest(const std::vector<Evaluation>& evaluations, double min_precision, double min_recall);
+    static bool saveSelection(std::string filename, int combination);
+    static int loadSelection(std::string filename, int default_combination);
+};
+
+#endif
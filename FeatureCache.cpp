@@ -0,0 +1,252 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#if defined _WIN32
+#  define NOMINMAX
+#  include <windows.h>
+#endif
+
+#include "FeatureCache.h"
+
+#include "Log.h"
+
+// Must be incremented whenever the layout of the cache files, or the way the features are computed, changes
+#define FEATURE_CACHE_VERSION 3
+#define FEATURE_CACHE_MAGIC 0x4346444E // "NDFC"
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+namespace {
+
+// Header at the beginning of every cache file
+struct CacheHeader {
+    unsigned int magic;
+    unsigned int version;
+    uint64 key;
+    uint64 source_hash;
+    int keypoints;
+    int rows;
+    int cols;
+    int type;
+};
+
+// Layout of a keypoint in the cache file
+struct CachedKeyPoint {
+    float x, y, size, angle, response;
+    int octave, class_id;
+};
+
+// Replaces a file with another one, in a single step so the readers find either the old or the new file.
+// Unlike rename, MoveFileEx can replace an existing file on Windows.
+bool replaceFile(const std::string& source, const std::string& destination) {
+#if defined _WIN32
+    return MoveFileExA(source.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(source.c_str(), destination.c_str()) == 0;
+#endif
+}
+
+}
+
+FeatureCache::FeatureCache(void) {}
+
+FeatureCache::FeatureCache(std::string directory) {
+    setDirectory(directory);
+}
+
+FeatureCache::~FeatureCache(void) {}
+
+void FeatureCache::setDirectory(std::string directory) {
+    directory_ = directory;
+    if (!directory_.empty() && directory_[directory_.size() - 1] != '/' && directory_[directory_.size() - 1] != '\\') {
+        directory_ += "/";
+    }
+}
+
+bool FeatureCache::isEnabled() {
+    return !directory_.empty();
+}
+
+// FNV-1a hash of a block of memory, chained with the given seed
+uint64 FeatureCache::hash(const void* data, size_t size, uint64 seed) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint64 h = seed;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// Hash of the contents of a file. Returns 0 if the file can't be read.
+uint64 FeatureCache::hashFile(std::string filename) {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return 0;
+    }
+    uint64 h = FNV_OFFSET_BASIS;
+    char buffer[1 << 16];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        h = hash(buffer, (size_t) file.gcount(), h);
+    }
+    return h;
+}
+
+// Name and parameters of an algorithm, as serialized by OpenCV
+std::string FeatureCache::algorithmSignature(cv::Algorithm* algorithm) {
+    cv::FileStorage fs(".yml", cv::FileStorage::WRITE + cv::FileStorage::MEMORY);
+    algorithm->write(fs);
+    return algorithm->name() + "\n" + fs.releaseAndGetString();
+}
+
+// Key that identifies the features of a note for a given combination of algorithms and patches
+uint64 FeatureCache::computeKey(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
+    std::stringstream ss;
+    ss << FEATURE_CACHE_VERSION << "\n" << note.getTag() << "\n"
+       << algorithmSignature(detector) << "\n" << algorithmSignature(extractor) << "\n";
+
+    std::vector<std::vector<cv::Point2f>>& patches = note.getPatches();
+    for (unsigned int i = 0; i < patches.size(); ++i) {
+        for (unsigned int j = 0; j < patches[i].size(); ++j) {
+            ss << patches[i][j].x << "," << patches[i][j].y << " ";
+        }
+        ss << "\n";
+    }
+
+    std::string signature = ss.str();
+    return hash(signature.data(), signature.size(), FNV_OFFSET_BASIS);
+}
+
+std::string FeatureCache::getFilename(NoteImgObject& note, uint64 key) {
+    std::stringstream ss;
+    ss << directory_ << note.getTag() << "_" << std::hex << std::setw(16) << std::setfill('0') << key << ".features";
+    return ss.str();
+}
+
+// Loads the note keypoints and descriptors from the cache. Returns false if they are
+// not cached or the cached file is outdated.
+bool FeatureCache::load(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
+    if (!isEnabled()) {
+        return false;
+    }
+
+    uint64 key = computeKey(note, detector, extractor);
+    std::ifstream file(getFilename(note, key).c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    CacheHeader header;
+    file.read((char*) &header, sizeof(header));
+    if (!file || header.magic != FEATURE_CACHE_MAGIC || header.version != FEATURE_CACHE_VERSION || header.key != key
+        || header.keypoints < 0 || header.rows != header.keypoints) {
+        return false;
+    }
+
+    // the header of a damaged file must not make the cache allocate more than the file holds
+    if (header.rows > 0 && (header.cols <= 0 || (header.type != CV_8U && header.type != CV_32F))) {
+        return false;
+    }
+    unsigned long long descriptor_bytes = header.rows > 0 ?
+        (unsigned long long) header.rows * header.cols * (header.type == CV_8U ? 1 : sizeof(float)) : 0;
+    unsigned long long expected_size = sizeof(CacheHeader) +
+        (unsigned long long) header.keypoints * sizeof(CachedKeyPoint) + descriptor_bytes;
+    file.seekg(0, std::ios::end);
+    std::streamoff file_size = file.tellg();
+    file.seekg(sizeof(CacheHeader), std::ios::beg);
+    if (!file || file_size < 0 || (unsigned long long) file_size != expected_size) {
+        return false;
+    }
+
+    // the source image changed since the features were computed
+    if (header.source_hash != hashFile(note.getFilename())) {
+        return false;
+    }
+
+    std::vector<CachedKeyPoint> cached_keypoints(header.keypoints);
+    if (header.keypoints > 0) {
+        file.read((char*) &cached_keypoints[0], sizeof(CachedKeyPoint) * header.keypoints);
+    }
+
+    cv::Mat descriptors;
+    if (header.rows > 0) {
+        descriptors.create(header.rows, header.cols, header.type);
+        file.read((char*) descriptors.data, descriptors.total() * descriptors.elemSize());
+    }
+
+    if (!file) {
+        return false;
+    }
+
+    std::vector<cv::KeyPoint> keypoints(header.keypoints);
+    for (int i = 0; i < header.keypoints; ++i) {
+        CachedKeyPoint& cached = cached_keypoints[i];
+        keypoints[i] = cv::KeyPoint(cached.x, cached.y, cached.size, cached.angle, cached.response, cached.octave, cached.class_id);
+    }
+
+    note.setFeatures(keypoints, descriptors);
+    return true;
+}
+
+// Saves the note keypoints and descriptors in the cache
+void FeatureCache::store(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
+    if (!isEnabled()) {
+        return;
+    }
+
+    // the features are written to a temporary file that then replaces the cached one, so a program reading
+    // the cache, or interrupted while writing it, never sees a partial file
+    uint64 key = computeKey(note, detector, extractor);
+    std::string filename = getFilename(note, key);
+    std::string temporary_filename = filename + ".tmp";
+    std::ofstream file(temporary_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        LOG_ERROR("Unable to write " << temporary_filename << "\n");
+        return;
+    }
+
+    std::vector<cv::KeyPoint>& keypoints = note.getKeypoints();
+    cv::Mat descriptors = note.getDescriptors();
+    if (!descriptors.isContinuous()) {
+        descriptors = descriptors.clone();
+    }
+
+    CacheHeader header;
+    header.magic = FEATURE_CACHE_MAGIC;
+    header.version = FEATURE_CACHE_VERSION;
+    header.key = key;
+    header.source_hash = hashFile(note.getFilename());
+    header.keypoints = (int) keypoints.size();
+    header.rows = descriptors.rows;
+    header.cols = descriptors.cols;
+    header.type = descriptors.type();
+    file.write((const char*) &header, sizeof(header));
+
+    std::vector<CachedKeyPoint> cached_keypoints(keypoints.size());
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        CachedKeyPoint& cached = cached_keypoints[i];
+        cached.x = keypoints[i].pt.x;
+        cached.y = keypoints[i].pt.y;
+        cached.size = keypoints[i].size;
+        cached.angle = keypoints[i].angle;
+        cached.response = keypoints[i].response;
+        cached.octave = keypoints[i].octave;
+        cached.class_id = keypoints[i].class_id;
+    }
+    if (!cached_keypoints.empty()) {
+        file.write((const char*) &cached_keypoints[0], sizeof(CachedKeyPoint) * cached_keypoints.size());
+    }
+
+    if (descriptors.rows > 0) {
+        file.write((const char*) descriptors.data, descriptors.total() * descriptors.elemSize());
+    }
+
+    file.close();
+    if (!file || !replaceFile(temporary_filename, filename)) {
+        LOG_ERROR("Unable to write " << filename << "\n");
+        std::remove(temporary_filename.c_str());
+    }
+}
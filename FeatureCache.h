@@ -0,0 +1,34 @@
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+#include "NoteImgObject.h"
+
+// Keeps the keypoints and descriptors of the library notes on disk, one file per
+// note and combination of algorithms, so they are only computed once.
+class FeatureCache {
+private:
+    std::string directory_;
+public:
+    FeatureCache(void);
+    FeatureCache(std::string directory);
+    ~FeatureCache(void);
+
+    void setDirectory(std::string directory);
+    bool isEnabled();
+    std::string getFilename(NoteImgObject& note, uint64 key);
+
+    bool load(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor);
+    void store(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor);
+
+    static uint64 hash(const void* data, size_t size, uint64 seed);
+    static uint64 hashFile(std::string filename);
+    static std::string algorithmSignature(cv::Algorithm* algorithm);
+    static uint64 computeKey(NoteImgObject& note, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor);
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include <algorithm>
+
+#include "FeatureTiling.h"
+
+// Keypoints of neighbouring tiles closer than this, in pixels, and in the same octave are the same keypoint
+#define DUPLICATE_DISTANCE 2.0f
+
+namespace {
+
+// Detects the keypoints of a range of tiles, keeping in each tile only the keypoints of its core
+class TileDetection : public cv::ParallelLoopBody {
+private:
+    const FeatureTiling& tiling_;
+    cv::FeatureDetector* detector_;
+    const cv::Mat& img_;
+    const cv::Mat& mask_;
+    std::vector<std::vector<cv::KeyPoint>>& tile_keypoints_;
+public:
+    TileDetection(const FeatureTiling& tiling, cv::FeatureDetector* detector, const cv::Mat& img, const cv::Mat& mask,
+                  std::vector<std::vector<cv::KeyPoint>>& tile_keypoints) :
+        tiling_(tiling), detector_(detector), img_(img), mask_(mask), tile_keypoints_(tile_keypoints) {}
+
+    void operator()(const cv::Range& range) const {
+        std::vector<cv::KeyPoint> keypoints;
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Rect region = tiling_.getRegion(i);
+            detector_->detect(img_(region), keypoints, mask_.empty() ? cv::Mat() : mask_(region));
+
+            std::vector<cv::KeyPoint>& owned = tile_keypoints_[i];
+            owned.clear();
+            cv::Point2f offset((float) region.x, (float) region.y);
+            for (unsigned int j = 0; j < keypoints.size(); ++j) {
+                keypoints[j].pt += offset;
+                if (tiling_.getOwner(keypoints[j].pt) == i) {
+                    owned.push_back(keypoints[j]);
+                }
+            }
+        }
+    }
+};
+
+// Extracts the descriptors of the keypoints owned by a range of tiles
+class TileDescription : public cv::ParallelLoopBody {
+private:
+    const FeatureTiling& tiling_;
+    cv::DescriptorExtractor* extractor_;
+    const cv::Mat& img_;
+    std::vector<std::vector<cv::KeyPoint>>& tile_keypoints_;
+    std::vector<cv::Mat>& tile_descriptors_;
+public:
+    TileDescription(const FeatureTiling& tiling, cv::DescriptorExtractor* extractor, const cv::Mat& img,
+                    std::vector<std::vector<cv::KeyPoint>>& tile_keypoints, std::vector<cv::Mat>& tile_descriptors) :
+        tiling_(tiling), extractor_(extractor), img_(img), tile_keypoints_(tile_keypoints), tile_descriptors_(tile_descriptors) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int i = range.start; i < range.end; ++i) {
+            std::vector<cv::KeyPoint>& keypoints = tile_keypoints_[i];
+            if (keypoints.empty()) {
+                continue;
+            }
+            cv::Rect region = tiling_.getRegion(i);
+            cv::Point2f offset((float) region.x, (float) region.y);
+            for (unsigned int j = 0; j < keypoints.size(); ++j) {
+                keypoints[j].pt -= offset;
+            }
+            // the extractor can discard keypoints, but it keeps the order of the others
+            extractor_->compute(img_(region), keypoints, tile_descriptors_[i]);
+            for (unsigned int j = 0; j < keypoints.size(); ++j) {
+                keypoints[j].pt += offset;
+            }
+        }
+    }
+};
+
+}
+
+// Tiles of about tile_size pixels, all of the same size except at the borders, covering an image of the given size
+FeatureTiling::FeatureTiling(cv::Size size, int tile_size, int overlap) {
+    size_ = size;
+    overlap_ = std::max(overlap, 0);
+    tile_size = std::max(tile_size, 1);
+    cols_ = std::max((size.width + tile_size - 1) / tile_size, 1);
+    rows_ = std::max((size.height + tile_size - 1) / tile_size, 1);
+    core_width_ = std::max((size.width + cols_ - 1) / cols_, 1);
+    core_height_ = std::max((size.height + rows_ - 1) / rows_, 1);
+}
+
+FeatureTiling::~FeatureTiling(void) {}
+
+int FeatureTiling::count() const {
+    return cols_ * rows_;
+}
+
+// Part of the image whose keypoints belong to the tile
+cv::Rect FeatureTiling::getCore(int tile) const {
+    cv::Rect core((tile % cols_) * core_width_, (tile / cols_) * core_height_, core_width_, core_height_);
+    return core & cv::Rect(0, 0, size_.width, size_.height);
+}
+
+// Part of the image processed for the tile: its core with the overlap around it
+cv::Rect FeatureTiling::getRegion(int tile) const {
+    cv::Rect core = getCore(tile);
+    cv::Rect region(core.x - overlap_, core.y - overlap_, core.width + 2 * overlap_, core.height + 2 * overlap_);
+    return region & cv::Rect(0, 0, size_.width, size_.height);
+}
+
+// Tile whose core has the point
+int FeatureTiling::getOwner(const cv::Point2f& point) const {
+    int col = std::min(std::max((int) (point.x / core_width_), 0), cols_ - 1);
+    int row = std::min(std::max((int) (point.y / core_height_), 0), rows_ - 1);
+    return row * cols_ + col;
+}
+
+// Detects the keypoints of img tile by tile, only where mask allows (an empty mask allows the whole image).
+// A detector that keeps a number of the best keypoints (nFeatures, as ORB and SIFT) keeps them for each tile,
+// so the best of all the tiles are kept afterwards.
+void FeatureTiling::detect(cv::FeatureDetector* detector, const cv::Mat& img, const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints) const {
+    std::vector<std::vector<cv::KeyPoint>> tile_keypoints(count());
+    cv::parallel_for_(cv::Range(0, count()), TileDetection(*this, detector, img, mask, tile_keypoints));
+
+    keypoints.clear();
+    for (int i = 0; i < count(); ++i) {
+        keypoints.insert(keypoints.end(), tile_keypoints[i].begin(), tile_keypoints[i].end());
+    }
+    removeDuplicates(keypoints);
+
+    std::vector<std::string> params;
+    detector->getParams(params);
+    if (std::find(params.begin(), params.end(), "nFeatures") != params.end()) {
+        int max_keypoints = detector->get<int>("nFeatures");
+        if (max_keypoints > 0 && (int) keypoints.size() > max_keypoints) {
+            cv::KeyPointsFilter::retainBest(keypoints, max_keypoints);
+        }
+    }
+}
+
+// The pyramids of the detectors are built for each tile, so a keypoint near the border between two cores can be
+// found by both tiles at slightly different positions. The one with the weakest response is removed.
+// Only the keypoints near the borders are compared, and each one only with those in its cell of a grid of
+// DUPLICATE_DISTANCE pixels or in the 8 cells around it, so the time grows as B log B with B border keypoints.
+void FeatureTiling::removeDuplicates(std::vector<cv::KeyPoint>& keypoints) const {
+    // the border keypoints with the key of their cell: its row and column, shifted so they are never negative
+    int grid_cols = (int) (size_.width / DUPLICATE_DISTANCE) + 3;
+    std::vector<std::pair<int64, int>> border;
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        cv::Rect core = getCore(getOwner(keypoints[i].pt));
+        const cv::Point2f& pt = keypoints[i].pt;
+        if (pt.x - core.x < DUPLICATE_DISTANCE || core.x + core.width - pt.x < DUPLICATE_DISTANCE ||
+            pt.y - core.y < DUPLICATE_DISTANCE || core.y + core.height - pt.y < DUPLICATE_DISTANCE) {
+            int64 col = cvFloor(pt.x / DUPLICATE_DISTANCE) + 1;
+            int64 row = cvFloor(pt.y / DUPLICATE_DISTANCE) + 1;
+            border.push_back(std::make_pair(row * grid_cols + col, (int) i));
+        }
+    }
+    // the keypoints are visited in their order, and their neighbours are looked up by cell
+    std::vector<std::pair<int64, int>> cells = border;
+    std::sort(cells.begin(), cells.end());
+
+    std::vector<char> removed(keypoints.size(), 0);
+    std::vector<int> neighbours;
+    bool any = false;
+    for (unsigned int i = 0; i < border.size(); ++i) {
+        // the neighbours after the keypoint, in the order of the keypoints, as a pairwise comparison would visit them
+        int a_index = border[i].second;
+        if (removed[a_index]) {
+            continue;
+        }
+        neighbours.clear();
+        for (int row = -1; row <= 1; ++row) {
+            int64 first_key = border[i].first + row * grid_cols - 1;
+            std::vector<std::pair<int64, int>>::const_iterator it =
+                std::lower_bound(cells.begin(), cells.end(), std::make_pair(first_key, -1));
+            for (; it != cells.end() && it->first <= first_key + 2; ++it) {
+                if (it->second > a_index) {
+                    neighbours.push_back(it->second);
+                }
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+
+        const cv::KeyPoint& a = keypoints[a_index];
+        for (unsigned int j = 0; j < neighbours.size() && !removed[a_index]; ++j) {
+            const cv::KeyPoint& b = keypoints[neighbours[j]];
+            cv::Point2f distance = a.pt - b.pt;
+            if (removed[neighbours[j]] || a.octave != b.octave || getOwner(a.pt) == getOwner(b.pt) ||
+                distance.dot(distance) >= DUPLICATE_DISTANCE * DUPLICATE_DISTANCE) {
+                continue;
+            }
+            removed[a.response >= b.response ? neighbours[j] : a_index] = 1;
+            any = true;
+        }
+    }
+    if (!any) {
+        return;
+    }
+
+    int kept = 0;
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        if (!removed[i]) {
+            keypoints[kept++] = keypoints[i];
+        }
+    }
+    keypoints.resize(kept);
+}
+
+// Extracts the descriptors of the keypoints tile by tile. The keypoints are sorted by tile, and the ones
+// the extractor discards are removed, so the rows of descriptors follow keypoints.
+void FeatureTiling::compute(cv::DescriptorExtractor* extractor, const cv::Mat& img, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const {
+    std::vector<std::vector<cv::KeyPoint>> tile_keypoints(count());
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        tile_keypoints[getOwner(keypoints[i].pt)].push_back(keypoints[i]);
+    }
+    std::vector<cv::Mat> tile_descriptors(count());
+    cv::parallel_for_(cv::Range(0, count()), TileDescription(*this, extractor, img, tile_keypoints, tile_descriptors));
+
+    keypoints.clear();
+    int rows = 0, cols = 0, type = 0;
+    for (int i = 0; i < count(); ++i) {
+        if (!tile_descriptors[i].empty()) {
+            rows += tile_descriptors[i].rows;
+            cols = tile_descriptors[i].cols;
+            type = tile_descriptors[i].type();
+        }
+    }
+    if (rows == 0) {
+        descriptors = cv::Mat();
+        return;
+    }
+
+    descriptors.create(rows, cols, type);
+    int row = 0;
+    for (int i = 0; i < count(); ++i) {
+        if (tile_descriptors[i].empty()) {
+            continue;
+        }
+        tile_descriptors[i].copyTo(descriptors.rowRange(row, row + tile_descriptors[i].rows));
+        row += tile_descriptors[i].rows;
+        keypoints.insert(keypoints.end(), tile_keypoints[i].begin(), tile_keypoints[i].end());
+    }
+}
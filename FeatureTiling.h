@@ -0,0 +1,34 @@
+#ifndef FEATURE_TILING_H
+#define FEATURE_TILING_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+// Splits an image in a grid of tiles whose features are detected and described concurrently. Each tile owns
+// the keypoints inside its core, but it is processed with overlap more pixels on every side, so the keypoints
+// near its borders see the same neighbourhood as in the whole image. The results of the tiles are merged in
+// their order, so they don't depend on the number of threads.
+class FeatureTiling {
+private:
+    cv::Size size_;
+    int overlap_;
+    int cols_, rows_;
+    int core_width_, core_height_;
+
+    void removeDuplicates(std::vector<cv::KeyPoint>& keypoints) const;
+public:
+    FeatureTiling(cv::Size size, int tile_size, int overlap);
+    ~FeatureTiling(void);
+
+    int count() const;
+    cv::Rect getCore(int tile) const;
+    cv::Rect getRegion(int tile) const;
+    int getOwner(const cv::Point2f& point) const;
+
+    void detect(cv::FeatureDetector* detector, const cv::Mat& img, const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints) const;
+    void compute(cv::DescriptorExtractor* extractor, const cv::Mat& img, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) const;
+};
+
+#endif
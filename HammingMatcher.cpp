@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "HammingMatcher.h"
+
+// Number of train descriptors compared with each query before moving to the next query.
+// 256 descriptors of 32 or 64 bytes stay in the L1 cache while all the queries are scanned.
+#define TRAIN_BLOCK_ROWS 256
+
+#if defined _MSC_VER
+#  include <intrin.h>
+#  define HAMMING_POPCNT 1
+#  define HAMMING_SSSE3 1
+#  if defined _M_X64
+#    define POPCOUNT64(x) ((int) _mm_popcnt_u64(x))
+#  else
+#    define POPCOUNT64(x) ((int) (_mm_popcnt_u32((unsigned int) (x)) + _mm_popcnt_u32((unsigned int) ((x) >> 32))))
+#  endif
+#else
+#  if defined __POPCNT__
+#    define HAMMING_POPCNT 1
+#    define POPCOUNT64(x) __builtin_popcountll(x)
+#  endif
+#  if defined __SSSE3__
+#    include <tmmintrin.h>
+#    define HAMMING_SSSE3 1
+#  endif
+#endif
+
+// The AVX2 function is compiled even if the rest of the program isn't, and only used when the CPU has AVX2
+#if defined _MSC_VER && _MSC_VER >= 1700 && (defined _M_X64 || defined _M_IX86)
+#  include <immintrin.h>
+#  define HAMMING_AVX2 1
+#  define TARGET_AVX2
+#elif defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && (defined __x86_64__ || defined __i386__)
+#  include <immintrin.h>
+#  include <cpuid.h>
+#  define HAMMING_AVX2 1
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// The AVX-512 function needs the VPOPCNTDQ intrinsics, from Visual Studio 2019 and GCC 7 on. With older compilers,
+// such as the Visual Studio 2012 of the project, it is left out and the AVX2 function is the fastest one.
+#if defined _MSC_VER && _MSC_VER >= 1920 && defined _M_X64
+#  define HAMMING_AVX512 1
+#  define TARGET_AVX512
+#elif defined __GNUC__ && !defined __clang__ && __GNUC__ >= 7 && defined __x86_64__
+#  define HAMMING_AVX512 1
+#  define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+
+namespace {
+
+// Portable popcount, used when the CPU has neither POPCNT nor SSSE3
+inline int popcount32(unsigned int x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    return (int) ((((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+// Distance of the last bytes, that don't fill a whole word
+inline int hammingTail(const uchar* a, const uchar* b, int from, int n_bytes) {
+    int distance = 0;
+    for (int j = from; j < n_bytes; ++j) {
+        distance += popcount32(a[j] ^ b[j]);
+    }
+    return distance;
+}
+
+void hammingBlockScalar(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances) {
+    for (int t = 0; t < n_train; ++t, train += train_step) {
+        int distance = 0;
+        int j = 0;
+        for (; j + 4 <= n_bytes; j += 4) {
+            unsigned int a, b;
+            memcpy(&a, query + j, 4);
+            memcpy(&b, train + j, 4);
+            distance += popcount32(a ^ b);
+        }
+        distances[t] = distance + hammingTail(query, train, j, n_bytes);
+    }
+}
+
+#if HAMMING_POPCNT
+void hammingBlockPopcnt(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances) {
+    for (int t = 0; t < n_train; ++t, train += train_step) {
+        int distance = 0;
+        int j = 0;
+        for (; j + 8 <= n_bytes; j += 8) {
+            uint64 a, b;
+            memcpy(&a, query + j, 8);
+            memcpy(&b, train + j, 8);
+            distance += POPCOUNT64(a ^ b);
+        }
+        distances[t] = distance + hammingTail(query, train, j, n_bytes);
+    }
+}
+#endif
+
+#if HAMMING_SSSE3
+// Counts the bits of each nibble with a 16 entries lookup table in a register (pshufb)
+void hammingBlockSSSE3(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances) {
+    const __m128i lookup = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    for (int t = 0; t < n_train; ++t, train += train_step) {
+        __m128i sum = zero;
+        int j = 0;
+        for (; j + 16 <= n_bytes; j += 16) {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (query + j)), _mm_loadu_si128((const __m128i*) (train + j)));
+            __m128i low = _mm_and_si128(x, low_mask);
+            __m128i high = _mm_and_si128(_mm_srli_epi16(x, 4), low_mask);
+            __m128i count = _mm_add_epi8(_mm_shuffle_epi8(lookup, low), _mm_shuffle_epi8(lookup, high));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(count, zero));
+        }
+        int distance = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+        distances[t] = distance + hammingTail(query, train, j, n_bytes);
+    }
+}
+#endif
+
+#if HAMMING_AVX2
+// The same lookup as hammingBlockSSSE3, on 32 bytes at a time: a whole ORB descriptor in one step
+TARGET_AVX2 void hammingBlockAVX2(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    for (int t = 0; t < n_train; ++t, train += train_step) {
+        __m256i sum = zero;
+        int j = 0;
+        for (; j + 32 <= n_bytes; j += 32) {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (query + j)), _mm256_loadu_si256((const __m256i*) (train + j)));
+            __m256i low = _mm256_and_si256(x, low_mask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+            __m256i count = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(count, zero));
+        }
+        __m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        int distance = _mm_cvtsi128_si32(sum128) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum128, sum128));
+        distances[t] = distance + hammingTail(query, train, j, n_bytes);
+    }
+}
+
+// Reads the extended features of the CPU (leaf 7 of cpuid) and the registers saved by the operating system
+// (XCR0). Returns false if the CPU can't tell them.
+bool readExtendedFeatures(unsigned int& ebx, unsigned int& ecx, unsigned int& xcr0) {
+    static const int OSXSAVE_BIT = 1 << 27;
+#  if defined _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    if (!(info[2] & OSXSAVE_BIT)) {
+        return false;
+    }
+    xcr0 = (unsigned int) _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    ebx = (unsigned int) info[1];
+    ecx = (unsigned int) info[2];
+#  else
+    unsigned int eax, edx;
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & OSXSAVE_BIT)) {
+        return false;
+    }
+    unsigned int xcr0_high;
+    __asm__("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+#  endif
+    return true;
+}
+
+// AVX2 needs both the CPU and the operating system, which must save the 256 bit registers
+bool hasAVX2() {
+    static const unsigned int AVX2_BIT = 1 << 5;
+    unsigned int ebx, ecx, xcr0;
+    return readExtendedFeatures(ebx, ecx, xcr0) && (xcr0 & 6) == 6 && (ebx & AVX2_BIT) != 0;
+}
+#endif
+
+#if HAMMING_AVX512
+// Counts the bits of 64 bytes at a time with VPOPCNTQ. The 32 bytes descriptors (ORB, BRIEF) are compared
+// two train descriptors at a time, one in each half of the register.
+TARGET_AVX512 void hammingBlockAVX512(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances) {
+    int t = 0;
+    if (n_bytes == 32) {
+        __m512i query2 = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*) query));
+        for (; t + 2 <= n_train; t += 2, train += 2 * train_step) {
+            __m512i train2 = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*) train)),
+                                                _mm256_loadu_si256((const __m256i*) (train + train_step)), 1);
+            __m512i count = _mm512_popcnt_epi64(_mm512_xor_si512(query2, train2));
+            distances[t] = (int) _mm512_mask_reduce_add_epi64(0x0F, count);
+            distances[t + 1] = (int) _mm512_mask_reduce_add_epi64(0xF0, count);
+        }
+    }
+    for (; t < n_train; ++t, train += train_step) {
+        __m512i sum = _mm512_setzero_si512();
+        int j = 0;
+        for (; j + 64 <= n_bytes; j += 64) {
+            __m512i x = _mm512_xor_si512(_mm512_loadu_si512(query + j), _mm512_loadu_si512(train + j));
+            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(x));
+        }
+        if (j < n_bytes) {
+            // the masked loads don't read past the last byte
+            __mmask64 mask = ~0ULL >> (64 - (n_bytes - j));
+            __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, query + j), _mm512_maskz_loadu_epi8(mask, train + j));
+            sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(x));
+        }
+        distances[t] = (int) _mm512_reduce_add_epi64(sum);
+    }
+}
+
+// AVX-512 needs the foundation, the byte masks and VPOPCNTDQ in the CPU, and the operating system must save
+// the mask registers and the 512 bit registers
+bool hasAVX512Popcnt() {
+    static const unsigned int AVX512F_BIT = 1 << 16;
+    static const unsigned int AVX512BW_BIT = 1u << 30;
+    static const unsigned int VPOPCNTDQ_BIT = 1 << 14;
+    unsigned int ebx, ecx, xcr0;
+    return readExtendedFeatures(ebx, ecx, xcr0) && (xcr0 & 0xE6) == 0xE6 &&
+        (ebx & AVX512F_BIT) != 0 && (ebx & AVX512BW_BIT) != 0 && (ecx & VPOPCNTDQ_BIT) != 0;
+}
+#endif
+
+// Order of the neighbours of a query: by distance, and the ties by train image and descriptor,
+// which is the order in which they are found
+inline bool isNearer(const cv::DMatch& a, const cv::DMatch& b) {
+    if (a.distance != b.distance) {
+        return a.distance < b.distance;
+    }
+    return a.imgIdx != b.imgIdx ? a.imgIdx < b.imgIdx : a.trainIdx < b.trainIdx;
+}
+
+// Chooses the fastest distance function supported by the CPU. VPOPCNTQ counts two 32 bytes descriptors
+// at once, and the AVX2 lookup beats POPCNT on the 32 and 64 bytes descriptors, since it counts a whole
+// descriptor with a few instructions.
+HammingBlockFunc selectKernel(std::string* name) {
+#if HAMMING_AVX512
+    if (hasAVX512Popcnt()) {
+        *name = "AVX-512 VPOPCNTDQ";
+        return hammingBlockAVX512;
+    }
+#endif
+#if HAMMING_AVX2
+    if (hasAVX2()) {
+        *name = "AVX2";
+        return hammingBlockAVX2;
+    }
+#endif
+#if HAMMING_POPCNT
+    if (cv::checkHardwareSupport(CV_CPU_POPCNT)) {
+        *name = "POPCNT";
+        return hammingBlockPopcnt;
+    }
+#endif
+#if HAMMING_SSSE3
+    if (cv::checkHardwareSupport(CV_CPU_SSSE3)) {
+        *name = "SSSE3";
+        return hammingBlockSSSE3;
+    }
+#endif
+    *name = "scalar";
+    return hammingBlockScalar;
+}
+
+}
+
+HammingMatcher::HammingMatcher(bool cross_check) {
+    cross_check_ = cross_check;
+    std::string name;
+    distance_block_ = selectKernel(&name);
+}
+
+HammingMatcher::~HammingMatcher(void) {}
+
+bool HammingMatcher::isMaskSupported() const {
+    return true;
+}
+
+cv::Ptr<cv::DescriptorMatcher> HammingMatcher::clone(bool emptyTrainData) const {
+    HammingMatcher* matcher = new HammingMatcher(cross_check_);
+    if (!emptyTrainData) {
+        matcher->trainDescCollection.resize(trainDescCollection.size());
+        for (unsigned int i = 0; i < trainDescCollection.size(); ++i) {
+            matcher->trainDescCollection[i] = trainDescCollection[i].clone();
+        }
+    }
+    return matcher;
+}
+
+// Name of the distance function used in this CPU
+std::string HammingMatcher::getKernelName() {
+    std::string name;
+    selectKernel(&name);
+    return name;
+}
+
+// Matches the query descriptors with the descriptors of one train image. If max_distance is negative,
+// the k nearest neighbours of each query are added to matches, otherwise all the neighbours within max_distance.
+// With cross check (only for k = 1), a match is kept only if the query is also the nearest neighbour of its train descriptor.
+void HammingMatcher::matchImage(const cv::Mat& query_descriptors, const cv::Mat& train_descriptors, const cv::Mat& mask,
+                                int img_idx, int k, float max_distance, std::vector<std::vector<cv::DMatch> >& matches,
+                                HammingWorkspace& workspace) {
+    int n_query = query_descriptors.rows;
+    int n_train = train_descriptors.rows;
+    int n_bytes = query_descriptors.cols;
+    bool radius = max_distance >= 0;
+    bool cross_check = cross_check_ && !radius && k == 1;
+    if (radius) {
+        k = 0;
+    }
+
+    // k best distances and train indices of each query, sorted by distance
+    std::vector<int>& best_distances = workspace.best_distances_;
+    std::vector<int>& best_indices = workspace.best_indices_;
+    best_distances.assign(n_query * k, INT_MAX);
+    best_indices.assign(n_query * k, -1);
+
+    // best query of each train descriptor, for the cross check
+    std::vector<int>& train_best_distances = workspace.train_best_distances_;
+    std::vector<int>& train_best_queries = workspace.train_best_queries_;
+    if (cross_check) {
+        train_best_distances.assign(n_train, INT_MAX);
+        train_best_queries.assign(n_train, -1);
+    }
+
+    std::vector<int>& distances = workspace.distances_;
+    distances.resize(TRAIN_BLOCK_ROWS);
+    for (int t0 = 0; t0 < n_train; t0 += TRAIN_BLOCK_ROWS) {
+        int t1 = std::min(t0 + TRAIN_BLOCK_ROWS, n_train);
+        for (int q = 0; q < n_query; ++q) {
+            const uchar* mask_row = mask.empty() ? NULL : mask.ptr(q);
+            int run_begin = t0;
+            while (run_begin < t1) {
+                // the distances are only computed for the runs of train descriptors allowed by the mask
+                int run_end = t1;
+                if (mask_row != NULL) {
+                    while (run_begin < t1 && mask_row[run_begin] == 0) {
+                        ++run_begin;
+                    }
+                    run_end = run_begin;
+                    while (run_end < t1 && mask_row[run_end] != 0) {
+                        ++run_end;
+                    }
+                    if (run_begin == run_end) {
+                        break;
+                    }
+                }
+                distance_block_(query_descriptors.ptr(q), train_descriptors.ptr(run_begin), train_descriptors.step,
+                                run_end - run_begin, n_bytes, &distances[0]);
+
+                for (int t = run_begin; t < run_end; ++t) {
+                    int distance = distances[t - run_begin];
+                    if (radius) {
+                        if (distance <= max_distance) {
+                            matches[q].push_back(cv::DMatch(q, t, img_idx, (float) distance));
+                        }
+                        continue;
+                    }
+
+                    int* query_distances = &best_distances[q * k];
+                    int* query_indices = &best_indices[q * k];
+                    if (distance < query_distances[k - 1]) {
+                        int j = k - 1;
+                        while (j > 0 && query_distances[j - 1] > distance) {
+                            query_distances[j] = query_distances[j - 1];
+                            query_indices[j] = query_indices[j - 1];
+                            --j;
+                        }
+                        query_distances[j] = distance;
+                        query_indices[j] = t;
+                    }
+
+                    if (cross_check && distance < train_best_distances[t]) {
+                        train_best_distances[t] = distance;
+                        train_best_queries[t] = q;
+                    }
+                }
+                run_begin = run_end;
+            }
+        }
+    }
+
+    for (int q = 0; q < n_query && !radius; ++q) {
+        for (int j = 0; j < k; ++j) {
+            int t = best_indices[q * k + j];
+            if (t < 0) {
+                break;
+            }
+            if (!cross_check || train_best_queries[t] == q) {
+                matches[q].push_back(cv::DMatch(q, t, img_idx, (float) best_distances[q * k + j]));
+            }
+        }
+    }
+}
+
+// Matches the query descriptors with all the train descriptors. The matches of each query are sorted by distance,
+// and only the k nearest are kept unless max_distance is given (radius search). Only the train images i with
+// train_images[i] set are searched, or all of them if train_images is empty.
+// The vectors of matches are emptied but kept, so their memory is reused.
+void HammingMatcher::matchCollection(const cv::Mat& query_descriptors, int k, float max_distance, const std::vector<cv::Mat>& masks,
+                                     const std::vector<char>& train_images, std::vector<std::vector<cv::DMatch> >& matches,
+                                     HammingWorkspace& workspace) {
+    CV_Assert(query_descriptors.empty() || query_descriptors.depth() == CV_8U);
+
+    matches.resize(query_descriptors.rows);
+    for (unsigned int q = 0; q < matches.size(); ++q) {
+        matches[q].clear();
+    }
+    if (query_descriptors.empty()) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < trainDescCollection.size(); ++i) {
+        const cv::Mat& train_descriptors = trainDescCollection[i];
+        if (train_descriptors.empty() || (i < train_images.size() && !train_images[i])) {
+            continue;
+        }
+        CV_Assert(train_descriptors.depth() == CV_8U && train_descriptors.cols == query_descriptors.cols);
+        matchImage(query_descriptors, train_descriptors, masks.empty() ? cv::Mat() : masks[i], i, k, max_distance, matches, workspace);
+    }
+
+    // keeps the k best matches among all the train images
+    bool radius = max_distance >= 0;
+    for (unsigned int q = 0; q < matches.size(); ++q) {
+        std::sort(matches[q].begin(), matches[q].end(), isNearer);
+        if (!radius && (int) matches[q].size() > k) {
+            matches[q].resize(k);
+        }
+    }
+}
+
+// The k nearest neighbours of each query among the train descriptors added to the matcher, with the buffers of workspace.
+// Unlike the knnMatch of cv::DescriptorMatcher, the vectors of matches are reused.
+void HammingMatcher::knnMatch(const cv::Mat& query_descriptors, std::vector<std::vector<cv::DMatch> >& matches, int k,
+                              HammingWorkspace& workspace) {
+    if (k <= 0) {
+        matches.clear();
+        return;
+    }
+    matchCollection(query_descriptors, k, -1, std::vector<cv::Mat>(), std::vector<char>(), matches, workspace);
+}
+
+// The k nearest neighbours of each query among the descriptors of the train images i with train_images[i] set,
+// with the buffers of workspace. The other images are skipped without computing any distance.
+void HammingMatcher::knnMatch(const cv::Mat& query_descriptors, std::vector<std::vector<cv::DMatch> >& matches, int k,
+                              const std::vector<char>& train_images, HammingWorkspace& workspace) {
+    if (k <= 0) {
+        matches.clear();
+        return;
+    }
+    matchCollection(query_descriptors, k, -1, std::vector<cv::Mat>(), train_images, matches, workspace);
+}
+
+// The nearest neighbour of each query among the given train descriptors (with the cross check, if enabled), with the
+// buffers of workspace. Unlike the match of cv::DescriptorMatcher, the matcher isn't cloned and matches is reused.
+void HammingMatcher::match(const cv::Mat& query_descriptors, const cv::Mat& train_descriptors, std::vector<cv::DMatch>& matches,
+                           HammingWorkspace& workspace) {
+    CV_Assert(query_descriptors.empty() || (query_descriptors.depth() == CV_8U && train_descriptors.depth() == CV_8U
+                                            && train_descriptors.cols == query_descriptors.cols));
+    matches.clear();
+    std::vector<std::vector<cv::DMatch> >& query_matches = workspace.matches_;
+    query_matches.resize(query_descriptors.rows);
+    for (unsigned int q = 0; q < query_matches.size(); ++q) {
+        query_matches[q].clear();
+    }
+    if (query_descriptors.empty() || train_descriptors.empty()) {
+        return;
+    }
+
+    matchImage(query_descriptors, train_descriptors, cv::Mat(), 0, 1, -1, query_matches, workspace);
+    for (unsigned int q = 0; q < query_matches.size(); ++q) {
+        if (!query_matches[q].empty()) {
+            matches.push_back(query_matches[q][0]);
+        }
+    }
+}
+
+// True if the matches of k = 1 searches are kept only when they are mutual, as with BFMatcher(NORM_HAMMING, true)
+bool HammingMatcher::isCrossCheck() const {
+    return cross_check_;
+}
+
+void HammingMatcher::knnMatchImpl(const cv::Mat& queryDescriptors, std::vector<std::vector<cv::DMatch> >& matches, int k,
+                                  const std::vector<cv::Mat>& masks, bool compactResult) {
+    matches.clear();
+    if (k <= 0) {
+        matches.resize(queryDescriptors.rows);
+        return;
+    }
+    HammingWorkspace workspace;
+    matchCollection(queryDescriptors, k, -1, masks, std::vector<char>(), matches, workspace);
+
+    if (compactResult) {
+        matches.erase(std::remove_if(matches.begin(), matches.end(), [](const std::vector<cv::DMatch>& m) { return m.empty(); }),
+                      matches.end());
+    }
+}
+
+void HammingMatcher::radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector<std::vector<cv::DMatch> >& matches, float maxDistance,
+                                     const std::vector<cv::Mat>& masks, bool compactResult) {
+    matches.clear();
+    if (maxDistance < 0) {
+        matches.resize(queryDescriptors.rows);
+        return;
+    }
+    HammingWorkspace workspace;
+    matchCollection(queryDescriptors, 0, maxDistance, masks, std::vector<char>(), matches, workspace);
+
+    if (compactResult) {
+        matches.erase(std::remove_if(matches.begin(), matches.end(), [](const std::vector<cv::DMatch>& m) { return m.empty(); }),
+                      matches.end());
+    }
+}
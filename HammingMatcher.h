@@ -0,0 +1,59 @@
+#ifndef HAMMING_MATCHER_H
+#define HAMMING_MATCHER_H
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+// Distances between one query descriptor and a range of train descriptors
+typedef void (*HammingBlockFunc)(const uchar* query, const uchar* train, size_t train_step, int n_train, int n_bytes, int* distances);
+
+// Buffers of the searches of a HammingMatcher. The searches given a workspace reuse its buffers,
+// so once they have grown to the sizes of the descriptors they don't allocate memory.
+struct HammingWorkspace {
+    std::vector<int> best_distances_;
+    std::vector<int> best_indices_;
+    std::vector<int> train_best_distances_;
+    std::vector<int> train_best_queries_;
+    std::vector<int> distances_;
+    std::vector<std::vector<cv::DMatch> > matches_;
+};
+
+// Brute force matcher for binary descriptors (ORB, BRIEF, FREAK) with the Hamming distance.
+// The train descriptors are scanned in blocks that fit in the cache and the distances are computed
+// with the fastest popcount available in the CPU (AVX2, POPCNT, SSSE3 or a lookup table), chosen at run time.
+// The train descriptors left out by a mask are skipped before their distances are computed.
+class HammingMatcher : public cv::DescriptorMatcher {
+private:
+    bool cross_check_;
+    HammingBlockFunc distance_block_;
+
+    void matchImage(const cv::Mat& query_descriptors, const cv::Mat& train_descriptors, const cv::Mat& mask,
+                    int img_idx, int k, float max_distance, std::vector<std::vector<cv::DMatch> >& matches, HammingWorkspace& workspace);
+    void matchCollection(const cv::Mat& query_descriptors, int k, float max_distance, const std::vector<cv::Mat>& masks,
+                         const std::vector<char>& train_images, std::vector<std::vector<cv::DMatch> >& matches,
+                         HammingWorkspace& workspace);
+public:
+    HammingMatcher(bool cross_check = false);
+    virtual ~HammingMatcher(void);
+
+    using cv::DescriptorMatcher::knnMatch;
+    using cv::DescriptorMatcher::match;
+    void knnMatch(const cv::Mat& query_descriptors, std::vector<std::vector<cv::DMatch> >& matches, int k, HammingWorkspace& workspace);
+    void knnMatch(const cv::Mat& query_descriptors, std::vector<std::vector<cv::DMatch> >& matches, int k,
+                  const std::vector<char>& train_images, HammingWorkspace& workspace);
+    void match(const cv::Mat& query_descriptors, const cv::Mat& train_descriptors, std::vector<cv::DMatch>& matches,
+               HammingWorkspace& workspace);
+
+    bool isCrossCheck() const;
+    virtual bool isMaskSupported() const;
+    virtual cv::Ptr<cv::DescriptorMatcher> clone(bool emptyTrainData = false) const;
+
+    static std::string getKernelName();
+protected:
+    virtual void knnMatchImpl(const cv::Mat& queryDescriptors, std::vector<std::vector<cv::DMatch> >& matches, int k,
+        const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+    virtual void radiusMatchImpl(const cv::Mat& queryDescriptors, std::vector<std::vector<cv::DMatch> >& matches, float maxDistance,
+        const std::vector<cv::Mat>& masks = std::vector<cv::Mat>(), bool compactResult = false);
+};
+
+#endif
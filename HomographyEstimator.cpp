@@ -0,0 +1,216 @@
+#include <cmath>
+#include <algorithm>
+
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "HomographyEstimator.h"
+
+// Number of points of a minimal sample
+#define SAMPLE_SIZE 4
+// Samples with an area (cross product) below this value are considered collinear
+#define MIN_SAMPLE_AREA 1e-2
+#define RNG_SEED 0x12345678
+
+HomographyEstimator::HomographyEstimator(double threshold, double confidence, int max_iterations) {
+    threshold_ = threshold;
+    confidence_ = confidence;
+    max_iterations_ = max_iterations;
+}
+
+HomographyEstimator::~HomographyEstimator(void) {}
+
+// Checks if a minimal sample can't give a valid homography: if three of the points are collinear,
+// or if the orientation of a triangle of points is not the same in both images (the note would be mirrored)
+bool HomographyEstimator::isDegenerate(const cv::Point2f* src, const cv::Point2f* dst) {
+    static const int triangles[4][3] = {{0, 1, 2}, {1, 2, 3}, {0, 2, 3}, {0, 1, 3}};
+    for (int t = 0; t < 4; ++t) {
+        const int* p = triangles[t];
+        double cross_src = (src[p[1]].x - src[p[0]].x) * (src[p[2]].y - src[p[0]].y) - (src[p[1]].y - src[p[0]].y) * (src[p[2]].x - src[p[0]].x);
+        double cross_dst = (dst[p[1]].x - dst[p[0]].x) * (dst[p[2]].y - dst[p[0]].y) - (dst[p[1]].y - dst[p[0]].y) * (dst[p[2]].x - dst[p[0]].x);
+        if (std::abs(cross_src) < MIN_SAMPLE_AREA || std::abs(cross_dst) < MIN_SAMPLE_AREA || (cross_src > 0) != (cross_dst > 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Counts the points whose reprojection error with the given homography is below the threshold.
+// If inliers isn't NULL, the indices of those points are added to it.
+int HomographyEstimator::countInliers(const cv::Mat& homography, std::vector<int>* inliers) {
+    const double* h = homography.ptr<double>();
+    const float h0 = (float) h[0], h1 = (float) h[1], h2 = (float) h[2];
+    const float h3 = (float) h[3], h4 = (float) h[4], h5 = (float) h[5];
+    const float h6 = (float) h[6], h7 = (float) h[7], h8 = (float) h[8];
+    const float threshold2 = (float) (threshold_ * threshold_);
+    const int n = (int) src_x_.size();
+
+    int count = 0;
+    int i = 0;
+#if CV_SSE2
+    // four points at a time
+    static const int mask_count[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+    const __m128 H0 = _mm_set1_ps(h0), H1 = _mm_set1_ps(h1), H2 = _mm_set1_ps(h2);
+    const __m128 H3 = _mm_set1_ps(h3), H4 = _mm_set1_ps(h4), H5 = _mm_set1_ps(h5);
+    const __m128 H6 = _mm_set1_ps(h6), H7 = _mm_set1_ps(h7), H8 = _mm_set1_ps(h8);
+    const __m128 T2 = _mm_set1_ps(threshold2);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&src_x_[i]);
+        __m128 y = _mm_loadu_ps(&src_y_[i]);
+        __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(H6, x), _mm_mul_ps(H7, y)), H8));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(H0, x), _mm_mul_ps(H1, y)), H2), w);
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(H3, x), _mm_mul_ps(H4, y)), H5), w);
+        __m128 du = _mm_sub_ps(u, _mm_loadu_ps(&dst_x_[i]));
+        __m128 dv = _mm_sub_ps(v, _mm_loadu_ps(&dst_y_[i]));
+        __m128 error = _mm_add_ps(_mm_mul_ps(du, du), _mm_mul_ps(dv, dv));
+        int mask = _mm_movemask_ps(_mm_cmplt_ps(error, T2));
+        count += mask_count[mask];
+        if (inliers != NULL && mask != 0) {
+            for (int b = 0; b < 4; ++b) {
+                if (mask & (1 << b)) {
+                    inliers->push_back(i + b);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        float w = 1.0f / (h6 * src_x_[i] + h7 * src_y_[i] + h8);
+        float du = (h0 * src_x_[i] + h1 * src_y_[i] + h2) * w - dst_x_[i];
+        float dv = (h3 * src_x_[i] + h4 * src_y_[i] + h5) * w - dst_y_[i];
+        if (du * du + dv * dv < threshold2) {
+            ++count;
+            if (inliers != NULL) {
+                inliers->push_back(i);
+            }
+        }
+    }
+    return count;
+}
+
+// Estimates the homography that maps points_src to points_dst. Returns false if no valid homography was found.
+// inliers keeps the indices of the points that agree with the homography.
+bool HomographyEstimator::estimate(const std::vector<cv::Point2f>& points_src, const std::vector<cv::Point2f>& points_dst,
+                                   cv::Mat& homography, std::vector<int>& inliers) {
+    inliers.clear();
+    const int n_points = (int) points_src.size();
+    if (n_points < SAMPLE_SIZE || points_dst.size() != points_src.size()) {
+        return false;
+    }
+
+    // the coordinates are kept as separate arrays to be read four at a time
+    src_x_.resize(n_points);
+    src_y_.resize(n_points);
+    dst_x_.resize(n_points);
+    dst_y_.resize(n_points);
+    for (int i = 0; i < n_points; ++i) {
+        src_x_[i] = points_src[i].x;
+        src_y_[i] = points_src[i].y;
+        dst_x_[i] = points_dst[i].x;
+        dst_y_[i] = points_dst[i].y;
+    }
+
+    cv::RNG rng(RNG_SEED);
+    cv::Mat best_homography;
+    int best_count = 0;
+    int iterations = max_iterations_;
+
+    // PROSAC growth function: T_n is the expected number of samples drawn only from the n best points
+    // when max_iterations_ samples are drawn by RANSAC from all the points
+    int n = SAMPLE_SIZE;
+    double T_n = max_iterations_;
+    for (int i = 0; i < SAMPLE_SIZE; ++i) {
+        T_n *= (double) (SAMPLE_SIZE - i) / (n_points - i);
+    }
+    int T_n_prime = 1;
+
+    cv::Point2f sample_src[SAMPLE_SIZE], sample_dst[SAMPLE_SIZE];
+    int sample[SAMPLE_SIZE];
+    for (int t = 1; t <= iterations; ++t) {
+        if (t > T_n_prime && n < n_points) {
+            double T_n_next = T_n * (n + 1) / (n + 1 - SAMPLE_SIZE);
+            T_n_prime += (int) std::ceil(T_n_next - T_n);
+            T_n = T_n_next;
+            ++n;
+        }
+
+        // the sample always includes the nth point, unless the growth function already allows any sample of the n best
+        int first_random = 0;
+        int range = n;
+        if (T_n_prime >= t) {
+            sample[0] = n - 1;
+            first_random = 1;
+            range = n - 1;
+        }
+        for (int i = first_random; i < SAMPLE_SIZE; ++i) {
+            bool repeated;
+            do {
+                sample[i] = rng.uniform(0, range);
+                repeated = false;
+                for (int j = 0; j < i; ++j) {
+                    repeated = repeated || sample[j] == sample[i];
+                }
+            } while (repeated);
+        }
+
+        for (int i = 0; i < SAMPLE_SIZE; ++i) {
+            sample_src[i] = points_src[sample[i]];
+            sample_dst[i] = points_dst[sample[i]];
+        }
+        if (isDegenerate(sample_src, sample_dst)) {
+            continue;
+        }
+
+        cv::Mat model = cv::getPerspectiveTransform(sample_src, sample_dst);
+        if (model.empty()) {
+            continue;
+        }
+
+        int count = countInliers(model, NULL);
+        if (count > best_count) {
+            best_count = count;
+            best_homography = model;
+
+            // number of iterations needed to find an all inliers sample with the given confidence
+            double inlier_ratio = (double) count / n_points;
+            double all_inliers = std::pow(inlier_ratio, SAMPLE_SIZE);
+            if (all_inliers >= 1) {
+                break;
+            }
+            double needed = std::log(1 - confidence_) / std::log(1 - all_inliers);
+            if (needed < iterations) {
+                iterations = std::max(t, (int) std::ceil(needed));
+            }
+        }
+    }
+
+    if (best_count < SAMPLE_SIZE) {
+        return false;
+    }
+
+    countInliers(best_homography, &inliers);
+
+    // least squares refinement with all the inliers, kept only if it doesn't lose inliers
+    inliers_src_.resize(inliers.size());
+    inliers_dst_.resize(inliers.size());
+    for (unsigned int i = 0; i < inliers.size(); ++i) {
+        inliers_src_[i] = points_src[inliers[i]];
+        inliers_dst_[i] = points_dst[inliers[i]];
+    }
+    cv::Mat refined = cv::findHomography(inliers_src_, inliers_dst_, 0);
+    if (!refined.empty()) {
+        refined_inliers_.clear();
+        if (countInliers(refined, &refined_inliers_) >= best_count) {
+            best_homography = refined;
+            inliers.swap(refined_inliers_);
+        }
+    }
+
+    homography = best_homography;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef HOMOGRAPHY_ESTIMATOR_H
+#define HOMOGRAPHY_ESTIMATOR_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+// Robust estimation of the homography between matched points with PROSAC: the minimal samples are drawn
+// progressively from the best matches first, so a good model is usually found after a few hypotheses.
+// The points must be sorted by the quality of their match (best first).
+class HomographyEstimator {
+private:
+    double threshold_;
+    double confidence_;
+    int max_iterations_;
+
+    // kept between estimations, so they are only allocated when more points than before are given
+    std::vector<float> src_x_, src_y_, dst_x_, dst_y_;
+    std::vector<cv::Point2f> inliers_src_, inliers_dst_;
+    std::vector<int> refined_inliers_;
+
+    int countInliers(const cv::Mat& homography, std::vector<int>* inliers);
+public:
+    HomographyEstimator(double threshold = 3, double confidence = 0.995, int max_iterations = 2000);
+    ~HomographyEstimator(void);
+
+    bool estimate(const std::vector<cv::Point2f>& points_src, const std::vector<cv::Point2f>& points_dst,
+                  cv::Mat& homography, std::vector<int>& inliers);
+
+    static bool isDegenerate(const cv::Point2f* src, const cv::Point2f* dst);
+};
+
+#endif
@@ -1,23 +1,218 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+
+#if defined _WIN32
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
 
 #include "ImgObject.h"
+#include "FeatureTiling.h"
 
+#include "Log.h"
 
-ImgObject::ImgObject(void) {}
+namespace {
 
-ImgObject::ImgObject(std::string filename, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    img_ = cv::imread(filename, cv::IMREAD_GRAYSCALE);
-    if(!img_.data) {
-        std::cout << " Error reading " << filename << std::endl;
-        exit(-1); 
+// Read-only view of a whole file mapped in memory, so it can be decoded without being copied first
+class MappedFile {
+private:
+    const uchar* data_;
+    size_t size_;
+#if defined _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int file_;
+#endif
+    MappedFile(MappedFile const&);
+    void operator=(MappedFile const&);
+public:
+    MappedFile(const std::string& filename) : data_(NULL), size_(0) {
+#if defined _WIN32
+        mapping_ = NULL;
+        file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+        if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+            return;
+        }
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ != NULL) {
+            data_ = (const uchar*) MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            size_ = data_ != NULL ? (size_t) size.QuadPart : 0;
+        }
+#else
+        file_ = open(filename.c_str(), O_RDONLY);
+        struct stat info;
+        if (file_ < 0 || fstat(file_, &info) != 0 || info.st_size == 0) {
+            return;
+        }
+        void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, file_, 0);
+        if (data != MAP_FAILED) {
+            data_ = (const uchar*) data;
+            size_ = (size_t) info.st_size;
+        }
+#endif
     }
 
-    if(detector != NULL && extractor != NULL) {
-        compute(detector, extractor);
+    ~MappedFile() {
+#if defined _WIN32
+        if (data_ != NULL) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != NULL) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_ != NULL) {
+            munmap((void*) data_, size_);
+        }
+        if (file_ >= 0) {
+            close(file_);
+        }
+#endif
     }
+
+    const uchar* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// Source of the image identifiers, unique for the whole program
+std::atomic<uint64> next_image_id(1);
+
+uint64 newImageId() {
+    return next_image_id++;
+}
+
+// Decodes an encoded image (jpg, png, ...) in grayscale or color, with its sides divided by reduction.
+// OpenCV 2.4 can't decode a JPEG at a reduced size, so the image is decoded at full size and resized afterwards:
+// the reduction saves the time of the detection, not of the decoding.
+cv::Mat decodeImage(const uchar* data, size_t size, int reduction, bool with_color) {
+    cv::Mat img = cv::imdecode(cv::Mat(1, (int) size, CV_8UC1, (void*) data), with_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE);
+    if (!img.empty() && reduction > 1) {
+        cv::Mat reduced;
+        cv::resize(img, reduced, cv::Size((img.cols + reduction - 1) / reduction, (img.rows + reduction - 1) / reduction), 0, 0, cv::INTER_AREA);
+        return reduced;
+    }
+    return img;
+}
+
+}
+
+
+KeypointMask::KeypointMask(void) {
+    reset(0);
+}
+
+KeypointMask::KeypointMask(size_t size) {
+    reset(size);
+}
+
+// Makes all the keypoints of an image with the given number of keypoints active
+void KeypointMask::reset(size_t size) {
+    removed_.assign(size, 0);
+    generation_ = 1;
+    active_ = (int) size;
+}
+
+// Makes all the keypoints active again, in constant time
+void KeypointMask::reset() {
+    ++generation_;
+    active_ = (int) removed_.size();
+    // the stamps can only be reused when the generation wraps around
+    if (generation_ == 0) {
+        reset(removed_.size());
+    }
+}
+
+void KeypointMask::remove(int index) {
+    if (removed_[index] != generation_) {
+        removed_[index] = generation_;
+        --active_;
+    }
+}
+
+bool KeypointMask::isActive(int index) const {
+    return removed_[index] != generation_;
+}
+
+int KeypointMask::countActive() const {
+    return active_;
+}
+
+ImgObject::ImgObject(void) : scale_(1), image_id_(newImageId()) {}
+
+// Image already in memory, in grayscale. The pixels are not copied.
+ImgObject::ImgObject(const cv::Mat& img) : scale_(1), image_id_(newImageId()) {
+    img_ = img;
+}
+
+// Grayscale frame given by a pointer to its first pixel, such as a camera buffer. The pixels are not copied,
+// so they must stay valid while the image is used.
+ImgObject::ImgObject(const uchar* data, int rows, int cols, size_t step) : scale_(1), image_id_(newImageId()) {
+    img_ = cv::Mat(rows, cols, CV_8UC1, (void*) data, step);
+}
+
+// Uses a new image, discarding the features of the previous one
+void ImgObject::setImage(const cv::Mat& img) {
+    img_ = img;
+    full_img_ = cv::Mat();
+    color_ = cv::Mat();
+    scale_ = 1;
+    image_id_ = newImageId();
+    keypoints_.clear();
+    descriptors_ = cv::Mat();
+    active_keypoints_.reset(0);
+    keypoint_grid_.build(keypoints_);
+    proposals_.clear();
+}
+
+// Reads an image file in grayscale, with its sides divided by reduction (1, 2, 4 or 8).
+// With with_color, the file is decoded in color and a low resolution color copy is kept as well.
+// The file is mapped in memory and decoded from there. Returns false if the image can't be read.
+bool ImgObject::read(const std::string& filename, int reduction, bool with_color) {
+    filename_ = filename;
+    MappedFile file(filename);
+    bool decoded = decode(file.data(), file.size(), reduction, with_color);
+    if (!decoded) {
+        LOG_ERROR("Error reading " << filename << "\n");
+    }
+    return decoded;
+}
+
+// Decodes an image (jpg, png, ...) in memory, and resizes it with its sides divided by reduction (1, 2, 4 or 8).
+// With with_color, a low resolution color copy is kept as well. Returns false if the data isn't a valid image.
+bool ImgObject::decode(const uchar* data, size_t size, int reduction, bool with_color) {
+    cv::Mat img;
+    if (data != NULL && size > 0) {
+        img = decodeImage(data, size, reduction, with_color);
+    }
+    if (!with_color || img.empty()) {
+        setImage(img);
+        return !img.empty();
+    }
+
+    cv::Mat gray;
+    cv::cvtColor(img, gray, CV_BGR2GRAY);
+    setImage(gray);
+    setColor(img);
+    return true;
+}
+
+bool ImgObject::empty() {
+    return img_.empty();
 }
 
 ImgObject::~ImgObject(void) {}
@@ -26,6 +221,70 @@ cv::Mat& ImgObject::getImg() {
     return img_;
 }
 
+// The image in its original resolution, even if the keypoints are detected in a reduced copy
+cv::Mat& ImgObject::getFullImg() {
+    return full_img_.empty() ? img_ : full_img_;
+}
+
+// Low resolution copy of the image in BGR, if it was read in color; otherwise it is empty
+cv::Mat& ImgObject::getColor() {
+    return color_;
+}
+
+// Keeps a copy of a color version of the image, reduced so its largest side is at most COLOR_MAX_DIMENSION
+void ImgObject::setColor(const cv::Mat& color) {
+    int largest = std::max(color.rows, color.cols);
+    if (largest <= COLOR_MAX_DIMENSION) {
+        color_ = color;
+        return;
+    }
+
+    double scale = (double) largest / COLOR_MAX_DIMENSION;
+    cv::Size size(std::max(cvRound(color.cols / scale), 1), std::max(cvRound(color.rows / scale), 1));
+    cv::resize(color, color_, size, 0, 0, cv::INTER_AREA);
+}
+
+// Factor that converts coordinates in the image where the keypoints are detected to coordinates in the full image
+float ImgObject::getScale() {
+    return scale_;
+}
+
+// Identifier of the image and mask where the keypoints are detected, so features computed for them can be reused
+uint64 ImgObject::getImageId() {
+    return image_id_;
+}
+
+// Detects the keypoints in a reduced copy of the image whose largest side is at most max_dimension.
+// If max_dimension is 0, or the image is already small enough, the full image is used.
+// The image isn't reduced again if it already has the same size.
+void ImgObject::setMaxDimension(int max_dimension) {
+    if (full_img_.empty()) {
+        full_img_ = img_;
+    }
+
+    int largest = std::max(full_img_.rows, full_img_.cols);
+    if (max_dimension <= 0 || largest <= max_dimension) {
+        if (img_.data != full_img_.data) {
+            img_ = full_img_;
+            image_id_ = newImageId();
+        }
+        scale_ = 1;
+        return;
+    }
+
+    scale_ = (float) largest / max_dimension;
+    cv::Size size(cvRound(full_img_.cols / scale_), cvRound(full_img_.rows / scale_));
+    if (img_.data != full_img_.data && img_.size() == size) {
+        return;
+    }
+    cv::resize(full_img_, img_, size, 0, 0, cv::INTER_AREA);
+    image_id_ = newImageId();
+}
+
+const std::string& ImgObject::getFilename() {
+    return filename_;
+}
+
 std::vector<cv::KeyPoint>& ImgObject::getKeypoints() {
     return keypoints_;
 }
@@ -34,27 +293,105 @@ cv::Mat& ImgObject::getDescriptors() {
     return descriptors_;
 }
 
-// Detects the image keypoints with the given algorithm
+cv::Mat& ImgObject::getMask() {
+    return mask_;
+}
+
+// Sets the mask of the pixels where keypoints can be detected. An empty mask allows the whole image.
+void ImgObject::setMask(const cv::Mat& mask) {
+    mask_ = mask;
+    image_id_ = newImageId();
+}
+
+// Only allows keypoints to be detected inside the given convex regions, in full image coordinates.
+// No regions allow the whole image.
+void ImgObject::setRegionOfInterest(const std::vector<std::vector<cv::Point2f>>& regions) {
+    image_id_ = newImageId();
+    if (regions.empty()) {
+        mask_ = cv::Mat();
+        return;
+    }
+
+    mask_ = cv::Mat::zeros(getFullImg().rows, getFullImg().cols, CV_8UC1);
+    for (unsigned int i = 0; i < regions.size(); ++i) {
+        std::vector<cv::Point> region(regions[i].size());
+        for (unsigned int j = 0; j < regions[i].size(); ++j) {
+            region[j] = cv::Point(cvRound(regions[i][j].x), cvRound(regions[i][j].y));
+        }
+        cv::fillConvexPoly(mask_, &region[0], (int) region.size(), cv::Scalar(255));
+    }
+}
+
+// Regions of the full image where notes may be, if they were searched by parts
+std::vector<cv::Rect>& ImgObject::getProposals() {
+    return proposals_;
+}
+
+KeypointMask& ImgObject::getActiveKeypoints() {
+    return active_keypoints_;
+}
+
+bool ImgObject::isActive(int index) {
+    return active_keypoints_.isActive(index);
+}
+
+// The mask of the pixels where keypoints can be detected, at the size of the image where they are detected
+cv::Mat ImgObject::getDetectionMask() {
+    // the mask is defined for the full image
+    if (!mask_.empty() && mask_.size() != img_.size()) {
+        cv::Mat mask;
+        cv::resize(mask_, mask, img_.size(), 0, 0, cv::INTER_NEAREST);
+        return mask;
+    }
+    return mask_;
+}
+
+// Detects the image keypoints with the given algorithm, only where the mask allows
 void ImgObject::detectKeypoints(cv::FeatureDetector* detector) {
-    detector->detect(img_, original_keypoints_);
+    detector->detect(img_, keypoints_, getDetectionMask());
 }
 
-// Extracts the descriptors from keypoints with the given algorithm
+// Extracts the descriptors from keypoints with the given algorithm. The extractor can discard
+// keypoints, so all the remaining ones are made active and indexed.
 void ImgObject::computeDescriptors(cv::DescriptorExtractor* extractor) {
-    extractor->compute(img_, original_keypoints_, original_descriptors_);
+    extractor->compute(img_, keypoints_, descriptors_);
+    active_keypoints_.reset(keypoints_.size());
+    keypoint_grid_.build(keypoints_);
+}
+
+// Detects the image keypoints concurrently in tiles of about tile_size pixels, each one processed with overlap
+// pixels around it, only where the mask allows. The keypoints found twice in the overlap are removed.
+void ImgObject::detectKeypointsTiled(cv::FeatureDetector* detector, int tile_size, int overlap) {
+    FeatureTiling tiling(img_.size(), tile_size, overlap);
+    tiling.detect(detector, img_, getDetectionMask(), keypoints_);
+}
+
+// Extracts the descriptors concurrently in the same tiles as detectKeypointsTiled. The keypoints are
+// sorted by tile, so all the remaining ones are made active and indexed.
+void ImgObject::computeDescriptorsTiled(cv::DescriptorExtractor* extractor, int tile_size, int overlap) {
+    FeatureTiling tiling(img_.size(), tile_size, overlap);
+    tiling.compute(extractor, img_, keypoints_, descriptors_);
+    active_keypoints_.reset(keypoints_.size());
+    keypoint_grid_.build(keypoints_);
 }
 
 // Detects the keypoints and extracts the descriptors with the given algorithms
 void ImgObject::compute(cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
     detectKeypoints(detector);
     computeDescriptors(extractor);
-    resetKeypoints();
 }
 
-// Reset the keypoints and descriptors to the original values
+// Uses already computed keypoints and descriptors instead of running the algorithms
+void ImgObject::setFeatures(const std::vector<cv::KeyPoint>& keypoints, const cv::Mat& descriptors) {
+    keypoints_ = keypoints;
+    descriptors_ = descriptors;
+    active_keypoints_.reset(keypoints_.size());
+    keypoint_grid_.build(keypoints_);
+}
+
+// Makes all the keypoints active again
 void ImgObject::resetKeypoints() {
-    keypoints_ = original_keypoints_;
-    descriptors_ = original_descriptors_.clone();
+    active_keypoints_.reset();
 }
 
 // Return a vector with the corners of a patch
@@ -68,20 +405,14 @@ std::vector<cv::Point2f> ImgObject::createPatch(int x0, int y0, int x1, int y1)
     return patch;
 }
 
-// Removes the image keypoints that are within the given contour
-void ImgObject::removeKeypointsInsideCountour(std::vector<cv::Point2f> countour) {
-    cv::Mat new_descriptors;
-    unsigned int j = 0;
-    for(unsigned int i = 0; i < keypoints_.size(); ++i, ++j) {
-        // if the point is inside the countour, remove it from the keypoints vector
-        if(cv::pointPolygonTest(countour, keypoints_[i].pt, false) >= 0) {
-            keypoints_.erase(keypoints_.begin() + i);
-            i--;
-        }
-        // otherwise, put in new_descriptors the descriptor correspondent to that point
-        else {
-            new_descriptors.push_back(descriptors_.row(j));
-        }
-    }
-    descriptors_ = new_descriptors;
+// Deactivates the image keypoints that are within the given contour. The keypoints and descriptors are kept.
+void ImgObject::removeKeypointsInsideCountour(const std::vector<cv::Point2f>& countour) {
+    removeKeypointsInsideCountour(countour, active_keypoints_);
+}
+
+// Deactivates in the given mask the image keypoints that are within the given contour,
+// so different masks can be used as independent views of the same image.
+// Only the keypoints of the grid cells overlapped by the contour are tested.
+void ImgObject::removeKeypointsInsideCountour(const std::vector<cv::Point2f>& countour, KeypointMask& active_keypoints) {
+    keypoint_grid_.removeInside(countour, active_keypoints);
 }
\ No newline at end of file
@@ -6,34 +6,92 @@
 #include "opencv2/core/core.hpp"
 #include "opencv2/features2d/features2d.hpp"
 
-//Class to represent an image. It keeps its keypoints and descriptors.
+#include "KeypointGrid.h"
+#include "ColorSignature.h"
+
+// Largest side of the low resolution color copy of an image
+#define COLOR_MAX_DIMENSION 128
+
+// Keeps which keypoints of an image are still active. Each removed keypoint is stamped with the
+// current generation, so all of them are made active again just by starting a new generation.
+class KeypointMask
+{
+private:
+    std::vector<unsigned int> removed_;
+    unsigned int generation_;
+    int active_;
+public:
+    KeypointMask(void);
+    KeypointMask(size_t size);
+
+    void reset(size_t size);
+    void reset();
+    void remove(int index);
+    bool isActive(int index) const;
+    int countActive() const;
+};
+
+//Class to represent an image. It keeps its keypoints and descriptors, which are not changed
+//when keypoints are removed: only the mask of active keypoints is.
 class ImgObject
 {
 protected:
     cv::Mat img_;
-    std::vector<cv::KeyPoint> original_keypoints_;
-    cv::Mat original_descriptors_;
-
+    cv::Mat full_img_;
+    cv::Mat color_;
+    float scale_;
+    // identifies the pixels and the mask where the keypoints are detected; it changes whenever any of them changes
+    uint64 image_id_;
+    std::string filename_;
     std::vector<cv::KeyPoint> keypoints_;
     cv::Mat descriptors_;
+    KeypointMask active_keypoints_;
+    KeypointGrid keypoint_grid_;
+    cv::Mat mask_;
+    std::vector<cv::Rect> proposals_;
     
     std::vector<std::vector<cv::Point2f>> patches_;
+
+    cv::Mat getDetectionMask();
 public:
     ImgObject(void);
-    ImgObject(std::string filename, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
+    ImgObject(const cv::Mat& img);
+    ImgObject(const uchar* data, int rows, int cols, size_t step = cv::Mat::AUTO_STEP);
     ~ImgObject(void);
 
+    bool read(const std::string& filename, int reduction = 1, bool with_color = false);
+    bool decode(const uchar* data, size_t size, int reduction = 1, bool with_color = false);
+    bool empty();
+    void setImage(const cv::Mat& img);
+
     cv::Mat& getImg();
+    cv::Mat& getFullImg();
+    cv::Mat& getColor();
+    void setColor(const cv::Mat& color);
+    float getScale();
+    uint64 getImageId();
+    void setMaxDimension(int max_dimension);
+    const std::string& getFilename();
     std::vector<cv::KeyPoint>& getKeypoints();
     cv::Mat& getDescriptors();
+    cv::Mat& getMask();
+    void setMask(const cv::Mat& mask);
+    void setRegionOfInterest(const std::vector<std::vector<cv::Point2f>>& regions);
+    std::vector<cv::Rect>& getProposals();
+    KeypointMask& getActiveKeypoints();
+    bool isActive(int index);
 
     virtual void detectKeypoints(cv::FeatureDetector* detector);
     void computeDescriptors(cv::DescriptorExtractor* extractor);
+    void detectKeypointsTiled(cv::FeatureDetector* detector, int tile_size, int overlap);
+    void computeDescriptorsTiled(cv::DescriptorExtractor* extractor, int tile_size, int overlap);
     void compute(cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor);
+    void setFeatures(const std::vector<cv::KeyPoint>& keypoints, const cv::Mat& descriptors);
     void resetKeypoints();
     static std::vector<cv::Point2f> createPatch(int x0, int y0, int x1, int y1);
 
-    void removeKeypointsInsideCountour(std::vector<cv::Point2f> countour);
+    void removeKeypointsInsideCountour(const std::vector<cv::Point2f>& countour);
+    void removeKeypointsInsideCountour(const std::vector<cv::Point2f>& countour, KeypointMask& active_keypoints);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cmath>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "KeypointGrid.h"
+#include "ImgObject.h"
+
+// Average number of keypoints in each cell of the grid
+#define KEYPOINTS_PER_CELL 8
+
+QuadRegion::QuadRegion(const std::vector<cv::Point2f>& countour) : countour_(&countour), convex_(false) {
+    min_x_ = min_y_ = max_x_ = max_y_ = 0;
+    for (unsigned int i = 0; i < countour.size(); ++i) {
+        min_x_ = i == 0 ? countour[i].x : std::min(min_x_, countour[i].x);
+        min_y_ = i == 0 ? countour[i].y : std::min(min_y_, countour[i].y);
+        max_x_ = i == 0 ? countour[i].x : std::max(max_x_, countour[i].x);
+        max_y_ = i == 0 ? countour[i].y : std::max(max_y_, countour[i].y);
+    }
+    if (countour.size() != 4) {
+        return;
+    }
+
+    // the quadrilateral is convex if it turns to the same side at every corner
+    double turns[4];
+    bool left = false, right = false;
+    for (int i = 0; i < 4; ++i) {
+        const cv::Point2f& p0 = countour[i];
+        const cv::Point2f& p1 = countour[(i + 1) % 4];
+        const cv::Point2f& p2 = countour[(i + 2) % 4];
+        turns[i] = (double) (p1.x - p0.x) * (p2.y - p1.y) - (double) (p1.y - p0.y) * (p2.x - p1.x);
+        left = left || turns[i] > 0;
+        right = right || turns[i] < 0;
+    }
+    convex_ = left != right;
+    if (!convex_) {
+        return;
+    }
+
+    // the edge equations are oriented so the inside of the quadrilateral is on their positive side
+    float orientation = left ? 1.0f : -1.0f;
+    for (int i = 0; i < 4; ++i) {
+        const cv::Point2f& p0 = countour[i];
+        const cv::Point2f& p1 = countour[(i + 1) % 4];
+        a_[i] = orientation * (p0.y - p1.y);
+        b_[i] = orientation * (p1.x - p0.x);
+        c_[i] = orientation * ((p1.y - p0.y) * p0.x - (p1.x - p0.x) * p0.y);
+    }
+}
+
+bool QuadRegion::contains(float x, float y) const {
+    if (x < min_x_ || x > max_x_ || y < min_y_ || y > max_y_) {
+        return false;
+    }
+    if (!convex_) {
+        return cv::pointPolygonTest(*countour_, cv::Point2f(x, y), false) >= 0;
+    }
+    for (int i = 0; i < 4; ++i) {
+        if (a_[i] * x + b_[i] * y + c_[i] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Tests four points at once. Bit i of the result is set if the point (x[i], y[i]) is inside.
+int QuadRegion::containsMask(const float* x, const float* y) const {
+#if CV_SSE2
+    if (convex_) {
+        const __m128 zero = _mm_setzero_ps();
+        __m128 px = _mm_loadu_ps(x);
+        __m128 py = _mm_loadu_ps(y);
+        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a_[0]), px), _mm_mul_ps(_mm_set1_ps(b_[0]), py)),
+                                                _mm_set1_ps(c_[0])), zero);
+        for (int i = 1; i < 4; ++i) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a_[i]), px), _mm_mul_ps(_mm_set1_ps(b_[i]), py)),
+                                         _mm_set1_ps(c_[i]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+        }
+        return _mm_movemask_ps(inside);
+    }
+#endif
+    int mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (contains(x[i], y[i])) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+float QuadRegion::getMinX() const {
+    return min_x_;
+}
+
+float QuadRegion::getMinY() const {
+    return min_y_;
+}
+
+float QuadRegion::getMaxX() const {
+    return max_x_;
+}
+
+float QuadRegion::getMaxY() const {
+    return max_y_;
+}
+
+KeypointGrid::KeypointGrid(void) : origin_x_(0), origin_y_(0), cell_scale_(1), cols_(0), rows_(0) {}
+
+KeypointGrid::~KeypointGrid(void) {}
+
+int KeypointGrid::getCol(float x) const {
+    return std::min(std::max((int) ((x - origin_x_) * cell_scale_), 0), cols_ - 1);
+}
+
+int KeypointGrid::getRow(float y) const {
+    return std::min(std::max((int) ((y - origin_y_) * cell_scale_), 0), rows_ - 1);
+}
+
+// Sorts the keypoints into the cells of a grid covering all of them. The buffers are kept, so building
+// the grid again for another image of about the same size doesn't allocate memory.
+void KeypointGrid::build(const std::vector<cv::KeyPoint>& keypoints) {
+    int n = (int) keypoints.size();
+    x_.resize(n);
+    y_.resize(n);
+    index_.resize(n);
+    if (n == 0) {
+        cols_ = rows_ = 0;
+        cell_start_.assign(1, 0);
+        return;
+    }
+
+    float min_x = keypoints[0].pt.x, min_y = keypoints[0].pt.y;
+    float max_x = min_x, max_y = min_y;
+    for (int i = 1; i < n; ++i) {
+        min_x = std::min(min_x, keypoints[i].pt.x);
+        min_y = std::min(min_y, keypoints[i].pt.y);
+        max_x = std::max(max_x, keypoints[i].pt.x);
+        max_y = std::max(max_y, keypoints[i].pt.y);
+    }
+
+    // square cells with KEYPOINTS_PER_CELL keypoints each if they were spread evenly
+    float width = max_x - min_x + 1;
+    float height = max_y - min_y + 1;
+    float cell_size = std::max(std::sqrt(width * height * KEYPOINTS_PER_CELL / n), 1.0f);
+    origin_x_ = min_x;
+    origin_y_ = min_y;
+    cell_scale_ = 1 / cell_size;
+    cols_ = (int) (width * cell_scale_) + 1;
+    rows_ = (int) (height * cell_scale_) + 1;
+
+    // counting sort by cell: cell_start_ first counts the keypoints of each cell
+    int n_cells = cols_ * rows_;
+    cell_start_.assign(n_cells + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        ++cell_start_[getRow(keypoints[i].pt.y) * cols_ + getCol(keypoints[i].pt.x) + 1];
+    }
+    for (int c = 0; c < n_cells; ++c) {
+        cell_start_[c + 1] += cell_start_[c];
+    }
+    // each keypoint is placed at the next free position of its cell, which leaves cell_start_ at the end of the cells
+    for (int i = 0; i < n; ++i) {
+        int position = cell_start_[getRow(keypoints[i].pt.y) * cols_ + getCol(keypoints[i].pt.x)]++;
+        x_[position] = keypoints[i].pt.x;
+        y_[position] = keypoints[i].pt.y;
+        index_[position] = i;
+    }
+    // the end of each cell is the beginning of the next one
+    for (int c = n_cells; c > 0; --c) {
+        cell_start_[c] = cell_start_[c - 1];
+    }
+    cell_start_[0] = 0;
+}
+
+// Deactivates in active_keypoints the keypoints within the given contour. Only the keypoints of the cells
+// overlapped by the bounding box of the contour are tested.
+void KeypointGrid::removeInside(const std::vector<cv::Point2f>& countour, KeypointMask& active_keypoints) const {
+    if (cols_ == 0) {
+        return;
+    }
+    QuadRegion region(countour);
+    if (region.getMaxX() < origin_x_ || region.getMaxY() < origin_y_ ||
+        region.getMinX() > origin_x_ + cols_ / cell_scale_ || region.getMinY() > origin_y_ + rows_ / cell_scale_) {
+        return;
+    }
+
+    int col0 = getCol(region.getMinX());
+    int col1 = getCol(region.getMaxX());
+    int row0 = getRow(region.getMinY());
+    int row1 = getRow(region.getMaxY());
+    for (int row = row0; row <= row1; ++row) {
+        // the keypoints of the cells of a row are contiguous
+        int begin = cell_start_[row * cols_ + col0];
+        int end = cell_start_[row * cols_ + col1 + 1];
+        int i = begin;
+        for (; i + 4 <= end; i += 4) {
+            int mask = region.containsMask(&x_[i], &y_[i]);
+            for (int b = 0; mask != 0; ++b, mask >>= 1) {
+                if ((mask & 1) && active_keypoints.isActive(index_[i + b])) {
+                    active_keypoints.remove(index_[i + b]);
+                }
+            }
+        }
+        for (; i < end; ++i) {
+            if (region.contains(x_[i], y_[i]) && active_keypoints.isActive(index_[i])) {
+                active_keypoints.remove(index_[i]);
+            }
+        }
+    }
+}
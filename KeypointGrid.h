@@ -0,0 +1,57 @@
+#ifndef KEYPOINT_GRID_H
+#define KEYPOINT_GRID_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+class KeypointMask;
+
+// A contour, such as the quadrilateral of a note found, that tells which points are inside it (or on its edges).
+// Convex quadrilaterals are tested against the half-planes of their four edges, four points at a time;
+// any other contour falls back to cv::pointPolygonTest. The contour must outlive the region.
+class QuadRegion {
+private:
+    const std::vector<cv::Point2f>* countour_;
+    bool convex_;
+    // the point (x, y) is on the inner side of edge i if a_[i] * x + b_[i] * y + c_[i] >= 0
+    float a_[4], b_[4], c_[4];
+    float min_x_, min_y_, max_x_, max_y_;
+public:
+    QuadRegion(const std::vector<cv::Point2f>& countour);
+
+    bool contains(float x, float y) const;
+    int containsMask(const float* x, const float* y) const;
+
+    float getMinX() const;
+    float getMinY() const;
+    float getMaxX() const;
+    float getMaxY() const;
+};
+
+// Uniform grid over the keypoints of an image. The coordinates are kept as separate arrays sorted by cell,
+// so the keypoints of consecutive cells of a row are contiguous and a region only tests the keypoints
+// of the cells it overlaps, whatever the number of keypoints in the image.
+class KeypointGrid {
+private:
+    float origin_x_, origin_y_;
+    float cell_scale_;
+    int cols_, rows_;
+
+    // the keypoints of cell c are the ones from cell_start_[c] to cell_start_[c + 1]
+    std::vector<int> cell_start_;
+    std::vector<float> x_, y_;
+    std::vector<int> index_;
+
+    int getCol(float x) const;
+    int getRow(float y) const;
+public:
+    KeypointGrid(void);
+    ~KeypointGrid(void);
+
+    void build(const std::vector<cv::KeyPoint>& keypoints);
+    void removeInside(const std::vector<cv::Point2f>& countour, KeypointMask& active_keypoints) const;
+};
+
+#endif
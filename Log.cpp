@@ -1,5 +1,21 @@
+#include <algorithm>
+#include <chrono>
+
 #include "Log.h"
 
+// Number of messages each thread can have waiting to be written
+#define LOG_BUFFER_SIZE 1024
+// Milliseconds between two writes when there are few messages
+#define LOG_WRITE_INTERVAL 20
+
+#if defined _MSC_VER
+#  define LOG_THREAD_LOCAL __declspec(thread)
+#else
+#  define LOG_THREAD_LOCAL __thread
+#endif
+
+LogBuffer::LogBuffer(void) : messages_(LOG_BUFFER_SIZE), sequences_(LOG_BUFFER_SIZE), head_(0), tail_(0) {}
+
 Log& Log::instance() {
     static Log instance;
     return instance;
@@ -7,13 +23,149 @@ Log& Log::instance() {
 
 void Log::open(std::string filename) {
     file_.open(filename, std::ios::out | std::ios::trunc);
+    closed_ = false;
+    if (!running_) {
+        running_ = true;
+        writer_ = std::thread(&Log::writerLoop, this);
+    }
+}
+
+// Enables or disables the copy of the messages to the standard output
+void Log::setConsoleOutput(bool console_output) {
+    flush();
+    console_output_ = console_output;
+}
+
+// Only the messages up to the given level are written
+void Log::setLevel(LogLevel level) {
+    level_ = level;
+}
+
+// The buffer of the calling thread, created the first time the thread logs a message.
+// The buffers are owned by the log and kept until the program ends, since they may still have messages when their thread ends.
+LogBuffer* Log::getThreadBuffer() {
+    static LOG_THREAD_LOCAL LogBuffer* buffer = NULL;
+    if (buffer == NULL) {
+        std::unique_ptr<LogBuffer> new_buffer(new LogBuffer());
+        buffer = new_buffer.get();
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers_.push_back(std::move(new_buffer));
+    }
+    return buffer;
+}
+
+void Log::write(std::string message) {
+    if (closed_) {
+        return;
+    }
+    if (!running_) {
+        // without the writer thread the message is written immediately
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        if (console_output_) {
+            std::cout << message;
+        }
+        file_ << message;
+        return;
+    }
+
+    LogBuffer* buffer = getThreadBuffer();
+    unsigned int head = buffer->head_.load(std::memory_order_relaxed);
+    // if the buffer is full, waits for the writer to make room
+    while (head - buffer->tail_.load(std::memory_order_acquire) >= LOG_BUFFER_SIZE) {
+        wake_.notify_one();
+        std::this_thread::yield();
+    }
+
+    buffer->messages_[head % LOG_BUFFER_SIZE].swap(message);
+    buffer->sequences_[head % LOG_BUFFER_SIZE] = sequence_++;
+    buffer->head_.store(head + 1, std::memory_order_release);
+
+    if (head - buffer->tail_.load(std::memory_order_relaxed) >= LOG_BUFFER_SIZE / 2) {
+        wake_.notify_one();
+    }
 }
 
-void Log::debug(std::string message) {
-    std::cout << message;
-    file_ << message;   
+namespace {
+
+// Orders the messages by sequence, counting from the next one to write, so the order survives the wrap around
+struct SequenceOrder {
+    unsigned int first_;
+    SequenceOrder(unsigned int first) : first_(first) {}
+    bool operator()(const std::pair<unsigned int, std::string>& a, const std::pair<unsigned int, std::string>& b) const {
+        return a.first - first_ < b.first - first_;
+    }
+};
+
 }
 
+// Writes the messages of all the threads, sorted by the order in which they were logged. A message is numbered
+// just before it is added to its buffer, so a later message of another thread may already be in its buffer: the
+// messages after such a gap are kept in pending_ until the missing one arrives, so the order is kept across drains.
+// With all_messages, which is used once no thread is logging, the pending messages are written as well.
+void Log::drain(bool all_messages) {
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+
+    std::vector<std::pair<unsigned int, std::string>>& messages = pending_;
+    {
+        std::lock_guard<std::mutex> buffers_lock(buffers_mutex_);
+        for (unsigned int i = 0; i < buffers_.size(); ++i) {
+            LogBuffer* buffer = buffers_[i].get();
+            unsigned int tail = buffer->tail_.load(std::memory_order_relaxed);
+            unsigned int head = buffer->head_.load(std::memory_order_acquire);
+            for (; tail != head; ++tail) {
+                messages.push_back(std::make_pair(buffer->sequences_[tail % LOG_BUFFER_SIZE], std::string()));
+                messages.back().second.swap(buffer->messages_[tail % LOG_BUFFER_SIZE]);
+            }
+            buffer->tail_.store(tail, std::memory_order_release);
+        }
+    }
+
+    if (messages.empty()) {
+        return;
+    }
+    std::sort(messages.begin(), messages.end(), SequenceOrder(next_sequence_));
+    unsigned int written = 0;
+    for (; written < messages.size(); ++written) {
+        if (messages[written].first != next_sequence_ && !all_messages) {
+            break;
+        }
+        if (console_output_) {
+            std::cout << messages[written].second;
+        }
+        file_ << messages[written].second;
+        next_sequence_ = messages[written].first + 1;
+    }
+    messages.erase(messages.begin(), messages.begin() + written);
+    if (console_output_) {
+        std::cout.flush();
+    }
+    file_.flush();
+}
+
+void Log::writerLoop() {
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_.wait_for(lock, std::chrono::milliseconds(LOG_WRITE_INTERVAL));
+        }
+        drain(false);
+    }
+}
+
+// Writes all the messages logged until now. The messages still being logged by other threads are
+// written by the next drain.
+void Log::flush() {
+    drain(false);
+}
+
+// Writes the remaining messages and closes the file. The messages logged from then on are discarded.
 void Log::close() {
+    closed_ = true;
+    if (running_) {
+        running_ = false;
+        wake_.notify_one();
+        writer_.join();
+    }
+    drain(true);
     file_.close();
-}
\ No newline at end of file
+}
@@ -3,20 +3,91 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
+// Levels of the messages, from the most to the least important
+enum LogLevel {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_DEBUG = 2
+};
+
+// Messages above this level are removed at compile time (e.g. /DLOG_MAX_LEVEL=0 keeps only the errors)
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Logs a message built with the stream operator, e.g. LOG_DEBUG("Matches: " << matches.size() << "\n").
+// The message is only formatted if its level is enabled.
+#define LOG(level, message) \
+    do { \
+        if ((level) <= LOG_MAX_LEVEL && Log::instance().isEnabled(level)) { \
+            std::ostringstream log_stream; \
+            log_stream << message; \
+            Log::instance().write(log_stream.str()); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(message) LOG(LOG_LEVEL_ERROR, message)
+#define LOG_INFO(message) LOG(LOG_LEVEL_INFO, message)
+#define LOG_DEBUG(message) LOG(LOG_LEVEL_DEBUG, message)
+
+// Messages of one thread waiting to be written. Only that thread adds messages and only the writer removes them,
+// so no lock is needed.
+struct LogBuffer {
+    LogBuffer(void);
+    std::vector<std::string> messages_;
+    std::vector<unsigned int> sequences_;
+    std::atomic<unsigned int> head_;
+    std::atomic<unsigned int> tail_;
+};
+
+// Writes the messages to a file and the standard output. While the log is open, the messages are written
+// by a background thread, in the order they were logged, so logging doesn't block the detection.
+// Before the log is opened the messages are written immediately; once it is closed they are discarded.
 class Log {
 public:
     static Log& instance();
     void open(std::string filename);
-    void debug(std::string message);
+    void setConsoleOutput(bool console_output);
+    void setLevel(LogLevel level);
+    bool isEnabled(int level) const { return level <= level_ && !closed_; }
+    void write(std::string message);
+    void flush();
     void close();
 private:
-    Log() {};
+    Log() : console_output_(true), level_(LOG_LEVEL_DEBUG), running_(false), closed_(false), sequence_(0), next_sequence_(0) {};
     Log(Log const&);
     void operator=(Log const&);
 
+    LogBuffer* getThreadBuffer();
+    void writerLoop();
+    void drain(bool all_messages);
+
     std::ofstream file_;
+    bool console_output_;
+    int level_;
+
+    std::vector<std::unique_ptr<LogBuffer>> buffers_;
+    std::mutex buffers_mutex_;
+    std::mutex drain_mutex_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::thread writer_;
+    std::atomic<bool> running_;
+    std::atomic<bool> closed_;
+    std::atomic<unsigned int> sequence_;
+    // messages taken from the buffers that wait for an earlier message still being logged, and the sequence
+    // of the next message to write
+    std::vector<std::pair<unsigned int, std::string>> pending_;
+    unsigned int next_sequence_;
 };
 
 #endif /* _LOG_H_ */
@@ -0,0 +1,127 @@
+#include <string>
+#include <sstream>
+
+#include "MemoryFeatureCache.h"
+#include "FeatureCache.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+MemoryFeatureCache::MemoryFeatureCache(size_t max_images) : hits_(0), misses_(0) {
+    setMaxImages(max_images);
+}
+
+// The features are not copied: a copy of a cache starts empty
+MemoryFeatureCache::MemoryFeatureCache(const MemoryFeatureCache& other) : hits_(0), misses_(0) {
+    max_images_ = other.max_images_;
+}
+
+MemoryFeatureCache& MemoryFeatureCache::operator=(const MemoryFeatureCache& other) {
+    if (this != &other) {
+        clear();
+        max_images_ = other.max_images_;
+    }
+    return *this;
+}
+
+MemoryFeatureCache::~MemoryFeatureCache(void) {}
+
+// Number of images kept for each detector, such as the notes and the scenes searched with every combination
+void MemoryFeatureCache::setMaxImages(size_t max_images) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_images_ = max_images > 0 ? max_images : 1;
+}
+
+// Features of an image for a detector, discarding the oldest image of the detector if it is full.
+// The mutex must be locked.
+MemoryFeatureCache::ImageFeatures& MemoryFeatureCache::getImage(uint64 detector_key, uint64 image_id) {
+    DetectorFeatures& detector = detectors_[detector_key];
+    std::map<uint64, ImageFeatures>::iterator it = detector.images_.find(image_id);
+    if (it == detector.images_.end()) {
+        while (detector.images_.size() >= max_images_ && !detector.order_.empty()) {
+            detector.images_.erase(detector.order_.front());
+            detector.order_.pop_front();
+        }
+        it = detector.images_.insert(std::make_pair(image_id, ImageFeatures())).first;
+        detector.order_.push_back(image_id);
+    }
+    return it->second;
+}
+
+// Features of an image for a detector, or NULL if there are none. The mutex must be locked.
+MemoryFeatureCache::ImageFeatures* MemoryFeatureCache::findImage(uint64 detector_key, uint64 image_id) {
+    std::map<uint64, DetectorFeatures>::iterator detector = detectors_.find(detector_key);
+    if (detector == detectors_.end()) {
+        return NULL;
+    }
+    std::map<uint64, ImageFeatures>::iterator it = detector->second.images_.find(image_id);
+    return it != detector->second.images_.end() ? &it->second : NULL;
+}
+
+// Gets the keypoints detected in the image with the given detector. Returns false if they are not in the cache.
+bool MemoryFeatureCache::getKeypoints(uint64 detector_key, uint64 image_id, std::vector<cv::KeyPoint>& keypoints) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ImageFeatures* image = findImage(detector_key, image_id);
+    if (image == NULL || !image->detected_) {
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+    keypoints = image->keypoints_;
+    return true;
+}
+
+void MemoryFeatureCache::putKeypoints(uint64 detector_key, uint64 image_id, const std::vector<cv::KeyPoint>& keypoints) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ImageFeatures& image = getImage(detector_key, image_id);
+    image.detected_ = true;
+    image.keypoints_ = keypoints;
+}
+
+// Gets the descriptors extracted with the given extractor from the keypoints of the detector, with the keypoints
+// the extractor kept. Returns false if they are not in the cache.
+bool MemoryFeatureCache::getDescriptors(uint64 detector_key, uint64 image_id, uint64 extractor_key,
+                                        std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ImageFeatures* image = findImage(detector_key, image_id);
+    std::map<uint64, Descriptors>::iterator it;
+    if (image == NULL || (it = image->descriptors_.find(extractor_key)) == image->descriptors_.end()) {
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+    keypoints = it->second.keypoints_;
+    descriptors = it->second.descriptors_.clone();
+    return true;
+}
+
+void MemoryFeatureCache::putDescriptors(uint64 detector_key, uint64 image_id, uint64 extractor_key,
+                                        const std::vector<cv::KeyPoint>& keypoints, const cv::Mat& descriptors) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Descriptors& entry = getImage(detector_key, image_id).descriptors_[extractor_key];
+    entry.keypoints_ = keypoints;
+    // the descriptors are copied, since the extractor may write the next ones over the same buffer
+    entry.descriptors_ = descriptors.clone();
+}
+
+void MemoryFeatureCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    detectors_.clear();
+}
+
+// Lookups of keypoints or descriptors that were in the cache
+long long MemoryFeatureCache::getHits() const {
+    return hits_;
+}
+
+// Lookups of keypoints or descriptors that had to be computed
+long long MemoryFeatureCache::getMisses() const {
+    return misses_;
+}
+
+// Key of an algorithm with its parameters, applied by tiles of the given size (0 for the whole image)
+uint64 MemoryFeatureCache::algorithmKey(cv::Algorithm* algorithm, int tile_size, int overlap) {
+    std::stringstream ss;
+    ss << FeatureCache::algorithmSignature(algorithm) << "\n" << tile_size << " " << overlap << "\n";
+    std::string signature = ss.str();
+    return FeatureCache::hash(signature.data(), signature.size(), FNV_OFFSET_BASIS);
+}
@@ -0,0 +1,66 @@
+#ifndef MEMORY_FEATURE_CACHE_H
+#define MEMORY_FEATURE_CACHE_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+// Keeps in memory the features computed for the images, so the combinations of algorithms that share a detector
+// don't detect the keypoints of an image again, and the ones that share a detector and an extractor don't extract
+// the descriptors again. Each detector keeps its own set of images, with their keypoints and the descriptors of
+// each extractor, so the combinations with other detectors don't discard them. The oldest images of a detector
+// are discarded when it has more than max_images.
+class MemoryFeatureCache {
+private:
+    struct Descriptors {
+        std::vector<cv::KeyPoint> keypoints_;
+        cv::Mat descriptors_;
+    };
+    struct ImageFeatures {
+        ImageFeatures() : detected_(false) {};
+        bool detected_;
+        std::vector<cv::KeyPoint> keypoints_;
+        // by extractor key
+        std::map<uint64, Descriptors> descriptors_;
+    };
+    struct DetectorFeatures {
+        std::map<uint64, ImageFeatures> images_;
+        std::deque<uint64> order_;
+    };
+
+    // by detector key
+    std::map<uint64, DetectorFeatures> detectors_;
+    size_t max_images_;
+    std::mutex mutex_;
+    std::atomic<long long> hits_;
+    std::atomic<long long> misses_;
+
+    ImageFeatures& getImage(uint64 detector_key, uint64 image_id);
+    ImageFeatures* findImage(uint64 detector_key, uint64 image_id);
+public:
+    MemoryFeatureCache(size_t max_images = 256);
+    MemoryFeatureCache(const MemoryFeatureCache& other);
+    MemoryFeatureCache& operator=(const MemoryFeatureCache& other);
+    ~MemoryFeatureCache(void);
+
+    void setMaxImages(size_t max_images);
+    bool getKeypoints(uint64 detector_key, uint64 image_id, std::vector<cv::KeyPoint>& keypoints);
+    void putKeypoints(uint64 detector_key, uint64 image_id, const std::vector<cv::KeyPoint>& keypoints);
+    bool getDescriptors(uint64 detector_key, uint64 image_id, uint64 extractor_key,
+                        std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors);
+    void putDescriptors(uint64 detector_key, uint64 image_id, uint64 extractor_key,
+                        const std::vector<cv::KeyPoint>& keypoints, const cv::Mat& descriptors);
+    void clear();
+
+    long long getHits() const;
+    long long getMisses() const;
+
+    static uint64 algorithmKey(cv::Algorithm* algorithm, int tile_size, int overlap);
+};
+
+#endif
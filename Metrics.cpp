@@ -0,0 +1,167 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#include "Metrics.h"
+
+#include "Log.h"
+
+const double Histogram::BOUNDS[HISTOGRAM_BUCKETS] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                                     0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+Histogram::Histogram(void) : sum_microseconds_(0) {
+    for (int i = 0; i <= HISTOGRAM_BUCKETS; ++i) {
+        counts_[i] = 0;
+    }
+}
+
+void Histogram::observe(double seconds) {
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS && seconds > BOUNDS[bucket]) {
+        ++bucket;
+    }
+    ++counts_[bucket];
+    sum_microseconds_ += (int64) (seconds * 1e6);
+}
+
+void Histogram::observeTicks(int64 ticks) {
+    observe(ticks / cv::getTickFrequency());
+}
+
+// Writes the cumulative buckets, the sum and the count in the Prometheus text format
+void Histogram::write(std::ostream& output, const std::string& name, const std::string& labels) const {
+    std::string separator = labels.empty() ? "" : ",";
+    int64 cumulative = 0;
+    for (int i = 0; i <= HISTOGRAM_BUCKETS; ++i) {
+        cumulative += counts_[i];
+        output << name << "_bucket{" << labels << separator << "le=\"";
+        if (i < HISTOGRAM_BUCKETS) {
+            output << BOUNDS[i];
+        } else {
+            output << "+Inf";
+        }
+        output << "\"} " << cumulative << "\n";
+    }
+    std::string braced = labels.empty() ? "" : "{" + labels + "}";
+    output << name << "_sum" << braced << " " << std::fixed << std::setprecision(6) << sum_microseconds_ / 1e6 << "\n";
+    output.unsetf(std::ios::floatfield);
+    output << name << "_count" << braced << " " << cumulative << "\n";
+}
+
+Metrics& Metrics::instance() {
+    static Metrics instance;
+    return instance;
+}
+
+// Returns the counter with the given name and labels, creating it the first time
+Counter* Metrics::counter(std::string name, std::string help, std::string labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family& family = families_[name];
+    family.help = help;
+    Counter*& counter = family.counters[labels];
+    if (counter == NULL) {
+        counter = new Counter();
+    }
+    return counter;
+}
+
+// Returns the histogram with the given name and labels, creating it the first time
+Histogram* Metrics::histogram(std::string name, std::string help, std::string labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family& family = families_[name];
+    family.help = help;
+    Histogram*& histogram = family.histograms[labels];
+    if (histogram == NULL) {
+        histogram = new Histogram();
+    }
+    return histogram;
+}
+
+// Labels of a metric in the Prometheus format, e.g. note="5F",combination="FAST/SURF/FlannBased"
+std::string Metrics::labels(std::string name1, std::string value1, std::string name2, std::string value2) {
+    std::string result;
+    for (int i = 0; i < 2; ++i) {
+        std::string& name = i == 0 ? name1 : name2;
+        std::string& value = i == 0 ? value1 : value2;
+        if (name.empty()) {
+            continue;
+        }
+        if (!result.empty()) {
+            result += ",";
+        }
+        result += name + "=\"";
+        for (unsigned int j = 0; j < value.size(); ++j) {
+            if (value[j] == '"' || value[j] == '\\') {
+                result += '\\';
+                result += value[j];
+            } else if (value[j] == '\n') {
+                result += "\\n";
+            } else {
+                result += value[j];
+            }
+        }
+        result += "\"";
+    }
+    return result;
+}
+
+// Writes all the metrics in the Prometheus text exposition format
+void Metrics::writePrometheus(std::ostream& output) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::map<std::string, Family>::iterator it = families_.begin(); it != families_.end(); ++it) {
+        const std::string& name = it->first;
+        Family& family = it->second;
+        output << "# HELP " << name << " " << family.help << "\n";
+        output << "# TYPE " << name << " " << (family.histograms.empty() ? "counter" : "histogram") << "\n";
+        for (std::map<std::string, Counter*>::iterator c = family.counters.begin(); c != family.counters.end(); ++c) {
+            output << name << (c->first.empty() ? "" : "{" + c->first + "}") << " " << c->second->get() << "\n";
+        }
+        for (std::map<std::string, Histogram*>::iterator h = family.histograms.begin(); h != family.histograms.end(); ++h) {
+            h->second->write(output, name, h->first);
+        }
+    }
+}
+
+// Writes the metrics to a file. The file is replaced at once, so a collector never reads it half written.
+bool Metrics::dump(std::string filename) {
+    std::string temporary = filename + ".tmp";
+    {
+        std::ofstream file(temporary.c_str(), std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            LOG_ERROR("Unable to write " << temporary << "\n");
+            return false;
+        }
+        writePrometheus(file);
+    }
+    std::remove(filename.c_str());
+    return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+// Dumps the metrics to a file every given number of seconds, until stopPeriodicDump
+void Metrics::startPeriodicDump(std::string filename, int seconds) {
+    stopPeriodicDump();
+    dump_filename_ = filename;
+    dump_interval_ = seconds > 0 ? seconds : 1;
+    dumping_ = true;
+    dump_thread_ = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(dump_mutex_);
+        while (dumping_) {
+            dump_wake_.wait_for(lock, std::chrono::seconds(dump_interval_));
+            dump(dump_filename_);
+        }
+    });
+}
+
+// Stops the periodic dump, writing the final values of the metrics
+void Metrics::stopPeriodicDump() {
+    {
+        std::lock_guard<std::mutex> lock(dump_mutex_);
+        if (!dumping_) {
+            return;
+        }
+        dumping_ = false;
+    }
+    dump_wake_.notify_one();
+    dump_thread_.join();
+}
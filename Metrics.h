@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+#include "opencv2/core/core.hpp"
+
+// Upper bounds in seconds of the buckets of the latency histograms (the last bucket, +Inf, is implicit)
+#define HISTOGRAM_BUCKETS 14
+
+// A value that only increases, such as the number of notes found
+class Counter {
+private:
+    std::atomic<int64> value_;
+public:
+    Counter(void) : value_(0) {};
+    void increment(int64 n = 1) { value_ += n; }
+    int64 get() const { return value_; }
+};
+
+// Distribution of latencies, in the fixed buckets of BOUNDS
+class Histogram {
+private:
+    std::atomic<int64> counts_[HISTOGRAM_BUCKETS + 1];
+    std::atomic<int64> sum_microseconds_;
+public:
+    Histogram(void);
+    void observe(double seconds);
+    void observeTicks(int64 ticks);
+    void write(std::ostream& output, const std::string& name, const std::string& labels) const;
+
+    static const double BOUNDS[HISTOGRAM_BUCKETS];
+};
+
+// Registry of the counters and histograms of the program. The metrics are identified by their name and labels,
+// and are never removed, so the pointers can be kept by the callers and updated without any lookup.
+class Metrics {
+public:
+    static Metrics& instance();
+    Counter* counter(std::string name, std::string help, std::string labels = "");
+    Histogram* histogram(std::string name, std::string help, std::string labels = "");
+    void writePrometheus(std::ostream& output);
+    bool dump(std::string filename);
+    void startPeriodicDump(std::string filename, int seconds);
+    void stopPeriodicDump();
+
+    static std::string labels(std::string name1, std::string value1, std::string name2 = "", std::string value2 = "");
+private:
+    Metrics() : dumping_(false) {};
+    Metrics(Metrics const&);
+    void operator=(Metrics const&);
+
+    // all the metrics with the same name, by their labels
+    struct Family {
+        std::string help;
+        std::map<std::string, Counter*> counters;
+        std::map<std::string, Histogram*> histograms;
+    };
+    std::map<std::string, Family> families_;
+    std::mutex mutex_;
+
+    std::string dump_filename_;
+    int dump_interval_;
+    std::thread dump_thread_;
+    std::mutex dump_mutex_;
+    std::condition_variable dump_wake_;
+    bool dumping_;
+};
+
+#endif
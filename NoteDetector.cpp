@@ -1,13 +1,31 @@
 #include <iostream>
 #include <iomanip>
-
-#include "windows.h"
+#include <algorithm>
+#include <csignal>
 
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/nonfree/features2d.hpp"
 
 #include "Log.h"
 #include "ObjectDetector.h"
+#include "BatchDetector.h"
+#include "ResultSink.h"
+#include "NoteTracker.h"
+#include "Benchmark.h"
+#include "AllocationCounter.h"
+#include "Evaluator.h"
+#include "Metrics.h"
+#include "DetectionServer.h"
+#include "HammingMatcher.h"
+#include "VocabularyIndex.h"
+#include "SelfTest.h"
+
+// Combination used by default, chosen by the -evaluate mode
+#define SELECTION_FILENAME "notes/combination.yml"
+// Seconds between two writes of the metrics file
+#define METRICS_DUMP_INTERVAL 10
+// Notes searched by default
+#define LIBRARY_FILENAME "notes/library.yml"
 
 // For a given combination <detector, extractor, matcher>,
 // allocates the respective algorithms
@@ -42,18 +60,70 @@ void getCombination(std::string feature_name, std::string descriptor_name, std::
     if (matcher_name == "FlannBased") {
         matcher = new cv::FlannBasedMatcher();
     } else if (matcher_name == "Bruteforce") {
-        matcher = new cv::BFMatcher(cv::NORM_HAMMING, true);
+        // the remaining descriptors are binary
+        matcher = new HammingMatcher(true);
+    }
+}
+
+// the server stopped by stopServer
+DetectionServer* running_server = NULL;
+
+// Stops the server on Ctrl+C or a termination request, so its workers are joined and the log
+// and the metrics are flushed before exiting
+void stopServer(int signal_number) {
+    if (running_server != NULL) {
+        running_server->stop();
     }
 }
 
-// Scan integer input from user betwwen a given min and max values
-int getInput(std::string prompt, int min, int max) {
+// Options of the search of the notes, shared by all the modes
+struct Options {
+    Options() : with_cache_(true), parallel_search_(false), region_proposals_(false), color_filter_(false),
+        max_dimension_(0), refine_max_dimension_(0), tile_size_(0), shortlist_size_(0) {};
+    bool with_cache_;
+    bool parallel_search_;
+    bool region_proposals_;
+    bool color_filter_;
+    int max_dimension_;
+    int refine_max_dimension_;
+    int tile_size_;
+    std::string vocabulary_filename_;
+    int shortlist_size_;
+};
+
+// Applies the options of the search to a detector, before its library is loaded
+void configureDetector(ObjectDetector& object_detector, const Options& options) {
+    if (options.with_cache_) {
+        // the features of the notes are cached next to their images
+        object_detector.setCacheDirectory("notes");
+    }
+    object_detector.setParallelSearch(options.parallel_search_);
+    object_detector.setRegionProposals(options.region_proposals_);
+    object_detector.setColorFilter(options.color_filter_);
+    object_detector.setTiling(options.tile_size_);
+    object_detector.setVocabulary(options.vocabulary_filename_, options.shortlist_size_);
+    object_detector.setPyramid(options.max_dimension_, options.refine_max_dimension_);
+}
+
+// Short name of a combination <detector, extractor, matcher>, used to label the results
+std::string getCombinationName(std::string combination[3]) {
+    return combination[0] + "/" + combination[1] + "/" + combination[2];
+}
+
+// Scan integer input from user betwwen a given min and max values.
+// An empty input (just Enter) chooses default_option, and the end of the input chooses min
+int getInput(std::string prompt, int min, int max, int default_option) {
     std::string input;
     int option;
     while (true) {
         std::cin.clear();
         std::cout << prompt;
-        std::getline(std::cin, input);
+        if (!std::getline(std::cin, input)) {
+            return min;
+        }
+        if (input.find_first_not_of(" \t\r") == std::string::npos) {
+            return default_option;
+        }
         std::stringstream sstream(input);
 
         if (sstream >> option && option >= min && option <= max) {
@@ -70,29 +140,184 @@ std::string getInput(std::string prompt) {
     return input;
 }
 
+void printUsage(std::string program) {
+    std::cout << "Usage: " << program << " [<filename>] [<options>]" << "\n"
+              << "       " << program << " -test [<directory|image|list.txt>] [-warmup <n>] [-repetitions <n>] [<options>]" << "\n"
+              << "       " << program << " -batch <directory|image|list.txt> [-threads <n>] [-combination <0-10>] [<options>]" << "\n"
+              << "       " << program << " -video <video|frames/%04d.jpg> [-keyframes <n>] [-combination <0-10>] [<options>]" << "\n"
+              << "       " << program << " -serve <port> [-threads <n>] [-queue <n>] [-combination <0-10>] [<options>]" << "\n"
+              << "       " << program << " -evaluate <annotations.yml> [-min-precision <0-1>] [-min-recall <0-1>] [<options>]" << "\n"
+              << "       " << program << " -train <vocabulary.yml> [-words <n>] [<options>]" << "\n"
+              << "       " << program << " -matchers [<directory|image|list.txt>] [-repetitions <n>] [<options>]" << "\n"
+              << "       " << program << " -selftest" << "\n"
+              << "Options: -nocache                   don't cache the features of the notes" << "\n"
+              << "         -parallel                  search the notes concurrently" << "\n"
+              << "         -proposals                 only search the notes in the note shaped regions of the scene" << "\n"
+              << "         -color                     don't search the notes whose colors are not in the scene" << "\n"
+              << "         -pyramid <max dimension>   search the notes in a reduced scene" << "\n"
+              << "         -tiles <tile size>         detect and describe the large scenes concurrently in tiles" << "\n"
+              << "         -refine <max dimension>    refine the notes found in the reduced scene" << "\n"
+              << "         -vocabulary <vocabulary>   only search the -shortlist notes most similar to the scene in the trained vocabulary" << "\n"
+              << "         -shortlist <n>             number of notes searched with a vocabulary (default 0, all of them)" << "\n"
+              << "         -library <manifest>        notes to search (default " << LIBRARY_FILENAME << ")" << "\n"
+              << "         -render <directory>        draw the notes found on the batch or video scenes and save them in directory" << "\n"
+              << "         -nooutput                  don't write the notes found in batch or video mode" << "\n"
+              << "         -reduce <1|2|4|8>          resize the decoded scenes with their sides divided by the given factor" << "\n"
+              << "         -metrics <filename>        write the metrics in the Prometheus text format every 10 seconds" << "\n"
+              << "         -loglevel <0-2>            log only errors (0, default in test mode), results (1) or everything (2, default)" << "\n";
+}
+
 int main(int argc, char** argv) {
     bool testing = false;
+    bool comparing_matchers = false;
+    bool self_testing = false;
     bool with_wait = true;
-
-    // Invalid number of arguments
-    if (argc > 3) {
-        std::cout << "Usage: " << argv[0] << " [<filename>] [-test]" << "\n";
-        return 1;
-    }
+    Options options;
 
     std::string filename = "";
-
-    // Checks parameters: filename (string) and testing mode (-t or -test)
+    std::string batch_path = "";
+    std::string video_source = "";
+    int keyframe_interval = 30;
+    int warmup = 1;
+    int repetitions = 5;
+    int threads = cv::getNumberOfCPUs();
+    int combination = -1;
+    std::string annotations_filename = "";
+    double min_precision = 0.9;
+    double min_recall = 0.9;
+    std::string train_filename = "";
+    int vocabulary_words = 1000;
+    int log_level = -1;
+    std::string metrics_filename = "";
+    std::string library_filename = LIBRARY_FILENAME;
+    int port = 0;
+    int max_queue = 64;
+    int reduction = 1;
+    std::string render_directory = "";
+    bool with_output = true;
+
+    // Checks parameters: filename (string), testing mode (-t or -test, with its options -warmup and -repetitions), feature cache (-nocache),
+    // parallel search of the notes (-parallel), region proposals (-proposals), color filter (-color), multi-resolution search (-pyramid and -refine),
+    // tiled features (-tiles), vocabulary shortlist (-vocabulary and -shortlist), log level (-loglevel), metrics file (-metrics),
+    // notes manifest (-library)
+    // batch mode (-batch, with its options -threads and -combination)
+    // video mode (-video, with its options -keyframes and -combination)
+    // evaluation mode (-evaluate, with its options -min-precision and -min-recall)
+    // training mode (-train, with its option -words)
+    // matcher comparison mode (-matchers, with its option -repetitions), self test mode (-selftest)
+    // and server mode (-serve, with its options -threads, -queue and -combination)
     for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "-test" || std::string(argv[i]) == "-t") {
+        std::string arg = argv[i];
+        if (arg == "-test" || arg == "-t") {
             testing = true;
+        } else if (arg == "-matchers") {
+            comparing_matchers = true;
+        } else if (arg == "-selftest") {
+            self_testing = true;
+        } else if (arg == "-nocache") {
+            options.with_cache_ = false;
+        } else if (arg == "-parallel") {
+            options.parallel_search_ = true;
+        } else if (arg == "-proposals") {
+            options.region_proposals_ = true;
+        } else if (arg == "-color") {
+            options.color_filter_ = true;
+        } else if (arg == "-pyramid" && i + 1 < argc) {
+            options.max_dimension_ = atoi(argv[++i]);
+        } else if (arg == "-refine" && i + 1 < argc) {
+            options.refine_max_dimension_ = atoi(argv[++i]);
+        } else if (arg == "-tiles" && i + 1 < argc) {
+            options.tile_size_ = atoi(argv[++i]);
+        } else if (arg == "-vocabulary" && i + 1 < argc) {
+            options.vocabulary_filename_ = argv[++i];
+        } else if (arg == "-shortlist" && i + 1 < argc) {
+            options.shortlist_size_ = atoi(argv[++i]);
+        } else if (arg == "-train" && i + 1 < argc) {
+            train_filename = argv[++i];
+        } else if (arg == "-words" && i + 1 < argc) {
+            vocabulary_words = atoi(argv[++i]);
+        } else if (arg == "-batch" && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (arg == "-video" && i + 1 < argc) {
+            video_source = argv[++i];
+        } else if (arg == "-keyframes" && i + 1 < argc) {
+            keyframe_interval = atoi(argv[++i]);
+        } else if (arg == "-warmup" && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (arg == "-repetitions" && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (arg == "-evaluate" && i + 1 < argc) {
+            annotations_filename = argv[++i];
+        } else if (arg == "-min-precision" && i + 1 < argc) {
+            min_precision = atof(argv[++i]);
+        } else if (arg == "-min-recall" && i + 1 < argc) {
+            min_recall = atof(argv[++i]);
+        } else if (arg == "-serve" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (arg == "-queue" && i + 1 < argc) {
+            max_queue = atoi(argv[++i]);
+        } else if (arg == "-render" && i + 1 < argc) {
+            render_directory = argv[++i];
+        } else if (arg == "-nooutput") {
+            with_output = false;
+        } else if (arg == "-reduce" && i + 1 < argc) {
+            reduction = atoi(argv[++i]);
+        } else if (arg == "-library" && i + 1 < argc) {
+            library_filename = argv[++i];
+        } else if (arg == "-metrics" && i + 1 < argc) {
+            metrics_filename = argv[++i];
+        } else if (arg == "-loglevel" && i + 1 < argc) {
+            log_level = atoi(argv[++i]);
+        } else if (arg == "-threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-combination" && i + 1 < argc) {
+            combination = atoi(argv[++i]);
+        } else if (arg[0] == '-' || filename != "") {
+            printUsage(argv[0]);
+            return 1;
         } else {
-            filename = argv[i];
+            filename = arg;
         }
     }
 
+    // the messages would be measured as part of the search, and allocate memory, so the test mode only logs errors
+    if (log_level == -1) {
+        log_level = testing ? LOG_LEVEL_ERROR : LOG_LEVEL_DEBUG;
+    }
+
+    // the combination selected by the last evaluation is used if none is given
+    if (combination == -1) {
+        combination = Evaluator::loadSelection(SELECTION_FILENAME, 0);
+    }
+
+    if (combination < 0 || combination > 10 || keyframe_interval < 1 || vocabulary_words < 1 || (reduction != 1 && reduction != 2 && reduction != 4 && reduction != 8) || log_level < LOG_LEVEL_ERROR || log_level > LOG_LEVEL_DEBUG) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (self_testing) {
+        // -------------------------------------------------------------
+        // Self test mode
+        // -------------------------------------------------------------
+        // Checks the optimized parts of the detection against the OpenCV implementations they replace, on synthetic
+        // images, so it doesn't need the notes. The results are written to the standard output; the exit code is 1 if any fails.
+        Log::instance().setLevel(LOG_LEVEL_ERROR);
+        SelfTest self_test(std::cout);
+        return self_test.run() ? 0 : 1;
+    }
+
+    // the notes are only read when they are used, but the manifest is checked before anything is done
+    if (NoteImgObject::loadManifest(library_filename, true).empty()) {
+        std::cerr << "No notes in " << library_filename << "\n";
+        return 1;
+    }
+
     Log& log = Log::instance();
+    log.setLevel((LogLevel) log_level);
     log.open("log.txt");
+    if (metrics_filename != "") {
+        Metrics::instance().startPeriodicDump(metrics_filename, METRICS_DUMP_INTERVAL);
+    }
 
     cv::FeatureDetector* detector = NULL; 
     cv::DescriptorExtractor* extractor =NULL; 
@@ -114,63 +339,198 @@ int main(int argc, char** argv) {
         {"SURF", "SURF",  "Bruteforce"}   
     };
 
-    // Ask user the filename if none was provided as parameter
-    if (filename == "") {
-        filename = getInput("Filename: ");
+    if (batch_path != "" || video_source != "" || port != 0) {
+        // -------------------------------------------------------------
+        // Batch, video and server modes
+        // -------------------------------------------------------------
+        // The results are written to the standard output (or sent to the clients) as JSON, so the log only goes to the file
+        log.setConsoleOutput(false);
+
+        std::string used_algorithms = "Feature Detector: " + combinations[combination][0] + " " +
+            "Descriptor Extractor: " + combinations[combination][1] + " " +
+            "Descriptor Matcher: " + combinations[combination][2] + "\n";
+        LOG_INFO(used_algorithms);
+        getCombination(combinations[combination][0], combinations[combination][1], combinations[combination][2],
+                       detector, extractor, matcher);
+
+        ObjectDetector object_detector = ObjectDetector(detector, extractor, matcher);
+        configureDetector(object_detector, options);
+        object_detector.loadLibrary(library_filename, true);
+        object_detector.setCombinationName(getCombinationName(combinations[combination]));
+        object_detector.computeAll(used_algorithms, detector, extractor, matcher);
+
+        // what is done with the notes found in the batch and video scenes
+        ResultSink* sink;
+        if (render_directory != "") {
+            sink = new RenderSink(render_directory);
+        } else if (with_output) {
+            sink = new JsonSink(std::cout);
+        } else {
+            sink = new NullSink();
+        }
+
+        int result = 0;
+        if (port != 0) {
+            // the library stays loaded while the server answers the requests
+            DetectionServer server(object_detector, port, threads, max_queue, reduction);
+            running_server = &server;
+            std::signal(SIGINT, stopServer);
+            std::signal(SIGTERM, stopServer);
+            if (!server.run()) {
+                std::cerr << "Unable to listen on port " << port << "\n";
+                result = 1;
+            }
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            running_server = NULL;
+        } else if (video_source != "") {
+            NoteTracker note_tracker(object_detector, keyframe_interval);
+            if (!note_tracker.run(video_source, *sink)) {
+                std::cerr << "Unable to open " << video_source << "\n";
+                result = 1;
+            }
+        } else {
+            BatchDetector batch_detector(object_detector, threads, reduction);
+            batch_detector.run(BatchDetector::listScenes(batch_path, object_detector.getLibraryFilenames()), *sink);
+        }
+        sink->close();
+        delete sink;
+
+        delete detector;
+        delete extractor;
+        delete matcher;
+        Metrics::instance().stopPeriodicDump();
+        log.close();
+        return result;
     }
 
-    // If in normal mode, ask user if he wants to hide the windows with the analysis results
-    if (!testing) {
-        std::string answer = "";
-        while (answer != "y" && answer != "Y" && answer != "n" && answer != "N") {
-            std::cout << "Hide windows with results (y/n)? ";
-            std::getline(std::cin, answer);
+    if (comparing_matchers) {
+        // -------------------------------------------------------------
+        // Matcher comparison mode
+        // -------------------------------------------------------------
+        // Checks that HammingMatcher finds the same neighbours as BFMatcher(NORM_HAMMING) for the ORB descriptors of
+        // the scenes (the notes directory if none is given) against those of the notes, and times both.
+        // The results are written to the standard output as CSV; the exit code is 1 if the matchers disagree.
+        log.setConsoleOutput(false);
+        cv::OrbFeatureDetector orb_detector;
+        cv::OrbDescriptorExtractor orb_extractor;
+
+        std::vector<NoteImgObject> notes = NoteImgObject::loadManifest(library_filename, true);
+        std::vector<std::string> note_filenames;
+        std::vector<cv::Mat> note_descriptors;
+        for (unsigned int i = 0; i < notes.size(); ++i) {
+            note_filenames.push_back(notes[i].getFilename());
+            if (notes[i].load()) {
+                notes[i].compute(&orb_detector, &orb_extractor);
+                if (!notes[i].getDescriptors().empty()) {
+                    note_descriptors.push_back(notes[i].getDescriptors());
+                }
+            }
         }
-        if (answer == "y") {
-            with_wait = false; // User don't want to see results of image analysis
+
+        std::vector<std::string> filenames = BatchDetector::listScenes(filename != "" ? filename : "notes", note_filenames);
+        std::vector<cv::Mat> scene_descriptors;
+        for (unsigned int i = 0; i < filenames.size(); ++i) {
+            ImgObject scene;
+            if (scene.read(filenames[i], reduction)) {
+                scene.compute(&orb_detector, &orb_extractor);
+                scene_descriptors.push_back(scene.getDescriptors());
+            }
         }
-    } else {
-        with_wait = false; // Don't show windows with results of image analysis
-    }
 
-    ObjectDetector object_detector = ObjectDetector(filename, detector, extractor, matcher);
-    object_detector.loadLibrary(true);
+        bool same = Benchmark::compareMatchers(note_descriptors, scene_descriptors, repetitions, std::cout);
+        Metrics::instance().stopPeriodicDump();
+        log.close();
+        return same ? 0 : 1;
+    }
 
-    if (testing) {
+    if (train_filename != "") {
         // -------------------------------------------------------------
-        // Test mode
+        // Training mode
         // -------------------------------------------------------------
-        LARGE_INTEGER frequency; // ticks per second
-        LARGE_INTEGER begin, end;
-        double elapsed_time;
+        // Trains the vocabulary of each pair of detector and extractor from the descriptors of the library notes,
+        // and writes all of them in the same file for the -vocabulary option
+        cv::FileStorage fs(train_filename, cv::FileStorage::WRITE);
+        if (!fs.isOpened()) {
+            std::cerr << "Unable to write " << train_filename << "\n";
+            Metrics::instance().stopPeriodicDump();
+            log.close();
+            return 1;
+        }
 
-        std::stringstream ss;
+        ObjectDetector object_detector = ObjectDetector(detector, extractor, matcher);
+        if (options.with_cache_) {
+            object_detector.setCacheDirectory("notes");
+        }
+        object_detector.loadLibrary(library_filename, true);
 
-        QueryPerformanceFrequency(&frequency);
-        
-        std::string used_algorithms;
-        // Test all available combinations. For each one, the elapsed time is recorded.
-        // Some of the inner function in this loop also record some metrics.
+        std::vector<std::string> trained;
         for (int i = 0; i < 11; ++i) {
-            used_algorithms = "Feature Detector: " + combinations[i][0] + " " +
+            std::string used_algorithms = "Feature Detector: " + combinations[i][0] + " " +
                 "Descriptor Extractor: " + combinations[i][1] + " " +
                 "Descriptor Matcher: " + combinations[i][2] + "\n";
-            log.debug(used_algorithms);
             getCombination(combinations[i][0], combinations[i][1], combinations[i][2],
                            detector, extractor, matcher);
 
-            object_detector.computeAll(used_algorithms, detector, extractor, matcher);
+            // the combinations that only differ in the matcher share the vocabulary
+            std::string name = VocabularyIndex::getNodeName(detector, extractor);
+            if (std::find(trained.begin(), trained.end(), name) == trained.end()) {
+                LOG_INFO(used_algorithms);
+                object_detector.setCombinationName(getCombinationName(combinations[i]));
+                object_detector.computeAll(used_algorithms, detector, extractor, matcher);
+                if (object_detector.trainVocabulary(fs, vocabulary_words)) {
+                    trained.push_back(name);
+                } else {
+                    LOG_ERROR("No descriptors to train " << name << "\n");
+                }
+            }
+
+            delete detector;
+            delete extractor;
+            delete matcher;
+            extractor = NULL;
+            detector = NULL;
+            matcher = NULL;
+        }
+        fs.release();
+
+        Metrics::instance().stopPeriodicDump();
+        log.close();
+        return trained.empty() ? 1 : 0;
+    }
 
-            QueryPerformanceCounter(&begin);
-            object_detector.findAllObjects(with_wait);
-            QueryPerformanceCounter(&end);
+    if (annotations_filename != "") {
+        // -------------------------------------------------------------
+        // Evaluation mode
+        // -------------------------------------------------------------
+        // Compares the notes found by each combination with the annotations and selects the fastest one
+        // that is accurate enough, which becomes the default if every note of the library is annotated.
+        // The results are written to the standard output as CSV.
+        log.setConsoleOutput(false);
+        Evaluator evaluator;
+        if (!evaluator.loadAnnotations(annotations_filename)) {
+            std::cerr << "Unable to read the annotations from " << annotations_filename << "\n";
+            Metrics::instance().stopPeriodicDump();
+            log.close();
+            return 1;
+        }
 
-            // elapsed time in milliseconds
-            elapsed_time = (end.QuadPart - begin.QuadPart) * 1000.0 / frequency.QuadPart;
+        ObjectDetector object_detector = ObjectDetector(detector, extractor, matcher);
+        configureDetector(object_detector, options);
+        object_detector.loadLibrary(library_filename, true);
+
+        std::vector<Evaluation> evaluations;
+        for (int i = 0; i < 11; ++i) {
+            std::string used_algorithms = "Feature Detector: " + combinations[i][0] + " " +
+                "Descriptor Extractor: " + combinations[i][1] + " " +
+                "Descriptor Matcher: " + combinations[i][2] + "\n";
+            LOG_INFO(used_algorithms);
+            getCombination(combinations[i][0], combinations[i][1], combinations[i][2],
+                           detector, extractor, matcher);
 
-            ss << "Elapsed time: " << elapsed_time << " ms\n";
-            log.debug(ss.str());
-            ss.str("");
+            object_detector.setCombinationName(getCombinationName(combinations[i]));
+            object_detector.computeAll(used_algorithms, detector, extractor, matcher);
+            evaluations.push_back(evaluator.evaluate(object_detector, getCombinationName(combinations[i])));
 
             delete detector;
             delete extractor;
@@ -179,59 +539,167 @@ int main(int argc, char** argv) {
             detector = NULL;
             matcher = NULL;
         }
-    } else {
+        Evaluator::writeCsv(evaluations, std::cout);
+
+        int selected = Evaluator::selectFastest(evaluations, min_precision, min_recall);
+        if (selected == -1) {
+            std::cerr << "No combination has a precision of " << min_precision << " and a recall of " << min_recall << "\n";
+            Metrics::instance().stopPeriodicDump();
+            log.close();
+            return 1;
+        }
+        std::cerr << "Selected combination " << selected << ": " << evaluations[selected].combination_ << "\n";
+
+        // the selection only becomes the default once the annotations have every note of the library
+        std::vector<NoteImgObject> library = NoteImgObject::loadManifest(library_filename, false);
+        std::vector<std::string> tags;
+        for (unsigned int i = 0; i < library.size(); ++i) {
+            tags.push_back(library[i].getTag());
+        }
+        std::vector<std::string> unannotated = evaluator.findUnannotated(tags);
+        if (unannotated.empty()) {
+            Evaluator::saveSelection(SELECTION_FILENAME, selected);
+        } else {
+            std::cerr << "Not saved as the default combination: no annotated scene has";
+            for (unsigned int i = 0; i < unannotated.size(); ++i) {
+                std::cerr << " " << unannotated[i];
+            }
+            std::cerr << "\n";
+        }
+
+        Metrics::instance().stopPeriodicDump();
+
+        log.close();
+        return 0;
+    }
+
+    if (testing) {
         // -------------------------------------------------------------
-        // Normal mode
+        // Test mode
         // -------------------------------------------------------------
-        int choice;
-        while (true) {
-            std::cout << "     Feature Detector | Descriptor Extractor | Descriptor Matcher" << "\n"
-                      << "-----------------------------------------------------------" << "\n";
-            for (int i = 0; i < 11; ++i) {
-                std::cout << std::setw(2) << i << " | " << std::setw(16) << combinations[i][0]
-                                               << " | " << std::setw(20) << combinations[i][1]
-                                               << " | " << std::setw(12) << combinations[i][2] << "\n";
+        // Times each stage of all the combinations in all the scenes (the notes directory, without the
+        // reference images of the library, if none is given).
+        // The statistics are written to the standard output as CSV, so the log only goes to the file.
+        log.setConsoleOutput(false);
+
+        ObjectDetector object_detector = ObjectDetector(detector, extractor, matcher);
+        configureDetector(object_detector, options);
+        object_detector.loadLibrary(library_filename, true);
+        std::vector<std::string> filenames = BatchDetector::listScenes(filename != "" ? filename : "notes",
+                                                                       object_detector.getLibraryFilenames());
+
+        Benchmark benchmark(object_detector, warmup, repetitions, reduction);
+        bool allocation_free = true;
+        for (int i = 0; i < 11; ++i) {
+            std::string used_algorithms = "Feature Detector: " + combinations[i][0] + " " +
+                "Descriptor Extractor: " + combinations[i][1] + " " +
+                "Descriptor Matcher: " + combinations[i][2] + "\n";
+            LOG_INFO(used_algorithms);
+            getCombination(combinations[i][0], combinations[i][1], combinations[i][2],
+                           detector, extractor, matcher);
+
+            object_detector.setCombinationName(getCombinationName(combinations[i]));
+            object_detector.computeAll(used_algorithms, detector, extractor, matcher);
+            if (!benchmark.run(getCombinationName(combinations[i]), filenames)) {
+                allocation_free = false;
             }
-            std::cout << "-----------------------------------------------------------" << "\n"
-                      << "11 | " << std::setw(54) << "All combinations" << "\n";
-            std::cout << "-----------------------------------------------------------" << "\n";
 
-            choice = getInput("Option (-1 to exit): ", -1, 11);
+            delete detector;
+            delete extractor;
+            delete matcher;
+            extractor = NULL;
+            detector = NULL;
+            matcher = NULL;
+        }
+        benchmark.writeCsv(std::cout);
+        // the features of the notes computed by one combination are reused by the next ones with the same detector
+        const MemoryFeatureCache& memory_cache = object_detector.getMemoryCache();
+        std::cerr << "Feature cache: " << memory_cache.getHits() << " hits, " << memory_cache.getMisses() << " misses" << "\n";
+        if (!AllocationCounter::isEnabled()) {
+            std::cerr << "Allocations not counted: build with NOTEDETECTOR_COUNT_ALLOCATIONS to check them" << "\n";
+        }
+
+        Metrics::instance().stopPeriodicDump();
 
-            if (choice == -1) {
-                break;
-            }
+        log.close();
+        // the search must not allocate memory once warmed up; the scenes that did are in the log
+        if (!allocation_free) {
+            std::cerr << "The search allocated memory after the warm-up" << "\n";
+            return 1;
+        }
+        return 0;
+    }
 
-            if (choice == 11) {
-                // User wants to use all the available combinations.
-                for (int i = 0; i < 11; ++i) {
-                    std::string title = "Feature Detector: " + combinations[i][0] + " " +
-                        "Descriptor Extractor: " + combinations[i][1] + " " +
-                        "Descriptor Matcher: " + combinations[i][2] + "\n";
-                    getCombination(combinations[i][0], combinations[i][1], combinations[i][2],
-                        detector, extractor, matcher);
-
-                    object_detector.computeAll(title, detector, extractor, matcher);
-
-                    object_detector.findAllObjects(with_wait);
-
-                    delete detector;
-                    delete extractor;
-                    delete matcher;
-                    extractor = NULL;
-                    detector = NULL;
-                    matcher = NULL;
-                }
-            } else {
-                getCombination(combinations[choice][0], combinations[choice][1], combinations[choice][2],
+    // Ask user the filename if none was provided as parameter
+    if (filename == "") {
+        filename = getInput("Filename: ");
+    }
+
+    // Ask user if he wants to hide the windows with the analysis results
+    std::string answer = "";
+    while (answer != "y" && answer != "Y" && answer != "n" && answer != "N") {
+        std::cout << "Hide windows with results (y/n)? ";
+        std::getline(std::cin, answer);
+    }
+    if (answer == "y") {
+        with_wait = false; // User don't want to see results of image analysis
+    }
+
+    ImgObject scene;
+    if (!scene.read(filename, reduction, options.color_filter_)) {
+        std::cerr << "Unable to read " << filename << "\n";
+        Metrics::instance().stopPeriodicDump();
+        log.close();
+        return 1;
+    }
+    ObjectDetector object_detector = ObjectDetector(detector, extractor, matcher);
+    configureDetector(object_detector, options);
+    // the same scene is searched with each combination chosen
+    object_detector.setReuseSceneFeatures(true);
+    object_detector.loadLibrary(library_filename, true);
+
+    // -------------------------------------------------------------
+    // Normal mode
+    // -------------------------------------------------------------
+    int choice;
+    while (true) {
+        std::cout << "     Feature Detector | Descriptor Extractor | Descriptor Matcher" << "\n"
+                  << "-----------------------------------------------------------" << "\n";
+        for (int i = 0; i < 11; ++i) {
+            std::cout << std::setw(2) << i << " | " << std::setw(16) << combinations[i][0]
+                                           << " | " << std::setw(20) << combinations[i][1]
+                                           << " | " << std::setw(12) << combinations[i][2]
+                                           << (i == combination ? " (selected)" : "") << "\n";
+        }
+        std::cout << "-----------------------------------------------------------" << "\n"
+                  << "11 | " << std::setw(54) << "All combinations" << "\n";
+        std::cout << "-----------------------------------------------------------" << "\n";
+
+        // the messages of the last option are shown before the menu
+        log.flush();
+        // Enter runs the selected combination
+        std::stringstream prompt;
+        prompt << "Option (-1 to exit, Enter for " << combination << "): ";
+        choice = getInput(prompt.str(), -1, 11, combination);
+
+        if (choice == -1) {
+            break;
+        }
+
+        if (choice == 11) {
+            // User wants to use all the available combinations.
+            for (int i = 0; i < 11; ++i) {
+                std::string title = "Feature Detector: " + combinations[i][0] + " " +
+                    "Descriptor Extractor: " + combinations[i][1] + " " +
+                    "Descriptor Matcher: " + combinations[i][2] + "\n";
+                getCombination(combinations[i][0], combinations[i][1], combinations[i][2],
                     detector, extractor, matcher);
 
-                std::string title = "Feature Detector: " + combinations[choice][0] + " " +
-                    "Descriptor Extractor: " + combinations[choice][1] + " " +
-                    "Descriptor Matcher: " + combinations[choice][2] + "\n";
+                object_detector.setCombinationName(getCombinationName(combinations[i]));
                 object_detector.computeAll(title, detector, extractor, matcher);
 
-                object_detector.findAllObjects(with_wait);
+                object_detector.computeScene(scene);
+                object_detector.findAllObjects(scene, with_wait);
 
                 delete detector;
                 delete extractor;
@@ -240,9 +708,30 @@ int main(int argc, char** argv) {
                 detector = NULL;
                 matcher = NULL;
             }
+        } else {
+            getCombination(combinations[choice][0], combinations[choice][1], combinations[choice][2],
+                detector, extractor, matcher);
+
+            std::string title = "Feature Detector: " + combinations[choice][0] + " " +
+                "Descriptor Extractor: " + combinations[choice][1] + " " +
+                "Descriptor Matcher: " + combinations[choice][2] + "\n";
+            object_detector.setCombinationName(getCombinationName(combinations[choice]));
+            object_detector.computeAll(title, detector, extractor, matcher);
+
+            object_detector.computeScene(scene);
+            object_detector.findAllObjects(scene, with_wait);
+
+            delete detector;
+            delete extractor;
+            delete matcher;
+            extractor = NULL;
+            detector = NULL;
+            matcher = NULL;
         }
     }
 
+    Metrics::instance().stopPeriodicDump();
+
     log.close();
 
     return 0;
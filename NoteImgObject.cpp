@@ -2,25 +2,18 @@
 
 #include "NoteImgObject.h"
 
+#include "Log.h"
+
 NoteImgObject::NoteImgObject(void) {}
 
-NoteImgObject::NoteImgObject(std::string tag, std::string filename, int value,
-                             cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor, std::vector<std::vector<cv::Point2f>> patches) :
-ImgObject(filename) {
+// The image is only read when the note is first used, by load
+NoteImgObject::NoteImgObject(const std::string& tag, const std::string& filename, int value, const std::string& series,
+                             const std::vector<std::vector<cv::Point2f>>& patches) {
     tag_ = tag;
+    filename_ = filename;
     value_ = value;
-
+    series_ = series;
     patches_ = patches;
-
-    corners_ = std::vector<cv::Point2f>(4);
-    corners_[0] = cv::Point(0, 0);
-    corners_[1] = cv::Point(img_.cols, 0);
-    corners_[2] = cv::Point(img_.cols, img_.rows);
-    corners_[3] = cv::Point(0, img_.rows);
-    
-    if(detector != NULL && extractor != NULL) {
-        compute(detector, extractor);
-    }
 }
 
 NoteImgObject::~NoteImgObject(void) {}
@@ -29,7 +22,7 @@ void NoteImgObject::setTag(std::string tag) {
     tag_ = tag;
 }
 
-std::string NoteImgObject::getTag() {
+const std::string& NoteImgObject::getTag() {
     return tag_;
 }
 
@@ -45,147 +38,86 @@ std::vector<cv::Point2f>& NoteImgObject::getCorners() {
     return corners_;
 }
 
-// Keeps only the keypoints that are inside the NoteImgObject patches
-void NoteImgObject::selectKeyPoints(std::vector<cv::KeyPoint> keypoints) {
-    // if the instance does not have any patches, it will keep all the keypoints
-    if(patches_.empty()) {
-        original_keypoints_ = keypoints;
-        return;
-    }
-    original_keypoints_.clear();
-    for(unsigned int i = 0; i < keypoints.size(); ++i) {
-        for(unsigned int j = 0; j < patches_.size(); ++j) {
-            // if the keypoint is inside a patch, it is kept
-            if(cv::pointPolygonTest(patches_[j], keypoints[i].pt, false) >= 0) {
-                original_keypoints_.push_back(keypoints[i]);
-                keypoints.erase(keypoints.begin() + i);
-                --i;
-                break;
-            }
-        }
-    }
+std::vector<std::vector<cv::Point2f>>& NoteImgObject::getPatches() {
+    return patches_;
 }
 
-// Override of ImgObject::detectKeypoints, where its is only kept the keypoints inside the image patches
-void NoteImgObject::detectKeypoints(cv::FeatureDetector* detector) {
-    std::vector<cv::KeyPoint> keypoints;
-    detector->detect(img_, keypoints);
-    selectKeyPoints(keypoints);
+// Hue histogram of the note, computed when it is loaded
+const ColorSignature& NoteImgObject::getColorSignature() {
+    return color_signature_;
 }
 
-// Creates a NoteImgObject for the 5 euro note (front), series 1
-NoteImgObject NoteImgObject::create5Front(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(7,6,7+17,6+24)); // left top
-        patches.push_back(ImgObject::createPatch(8,99,8+22,99+32)); // left bottom
-        patches.push_back(ImgObject::createPatch(188,6,188+37,6+60)); // right top
-        patches.push_back(ImgObject::createPatch(130,10,130+101,10+118)); // arc
-    }
-    return NoteImgObject("5F", "notes/5eu_r.jpg", 5, detector, extractor, patches);
+std::string NoteImgObject::getSeries() {
+    return series_;
 }
 
-// Creates a NoteImgObject for the 5 euro note (front), series Europa
-NoteImgObject NoteImgObject::create5NFront(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(175,19,175+50,19+79));
-        patches.push_back(ImgObject::createPatch(46,177,46+36,177+54));
-        patches.push_back(ImgObject::createPatch(236,33,236+169,33+201));
-    }
-    return NoteImgObject("5NF", "notes/5_new_front.png", 5, detector, extractor, patches);
+bool NoteImgObject::isLoaded() {
+    return !img_.empty();
 }
 
-// Creates a NoteImgObject for the 5 euro note (back), series 1
-NoteImgObject NoteImgObject::create5Back(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(7,7,7+115,7+73)); // left top
-        patches.push_back(ImgObject::createPatch(6,100,6+22,100+32)); // left bottom
-        patches.push_back(ImgObject::createPatch(239,5,239+18,5+25)); // right top
-        patches.push_back(ImgObject::createPatch(241,106,241+15,106+24)); // right bottom
+// Reads the note image, if it wasn't read yet. Returns false if the image can't be read.
+// The notes are loaded before the scenes are searched, so this is never called concurrently.
+bool NoteImgObject::load() {
+    if (isLoaded()) {
+        return true;
     }
-    return NoteImgObject("5B", "notes/5eu_v.jpg", 5, detector, extractor, patches);
-}
 
-// Creates a NoteImgObject for the 5 euro note (back), series Europa
-NoteImgObject NoteImgObject::create5NBack(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(17,14,17+305,14+73));
-        patches.push_back(ImgObject::createPatch(327,157, 327+59,157+94));
+    // the note is read in color to compute its signature, which is cheap next to its keypoints
+    if (!read(filename_, 1, true)) {
+        return false;
     }
-    return NoteImgObject("5NB", "notes/5_new_back.png", 5, detector, extractor, patches);
-}
+    color_signature_.compute(color_);
 
-// Creates a NoteImgObject for the 10 euro note (front)
-NoteImgObject NoteImgObject::create10Front(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(5,5,5+25,5+24)); // left top
-        patches.push_back(ImgObject::createPatch(5,104,5+32,104+29)); // left bottom
-        patches.push_back(ImgObject::createPatch(169,6,169+59,6+51)); // right top
-        patches.push_back(ImgObject::createPatch(135,29,135+96,29+102)); // arc
-    }
-    return NoteImgObject("10F", "notes/10eu_r.jpg", 10, detector, extractor, patches);
-}
+    // the keypoints are only detected inside the patches
+    setRegionOfInterest(patches_);
 
-// Creates a NoteImgObject for the 10 euro note (back)
-NoteImgObject NoteImgObject::create10Back(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(8,6,8+149,6+47)); // left top
-        patches.push_back(ImgObject::createPatch(9,104,9+27,104+30)); // left bottom
-        patches.push_back(ImgObject::createPatch(233,4,233+25,4+24)); // right top
-        patches.push_back(ImgObject::createPatch(235,110,235+24,110+23)); // right bottom
+    corners_ = std::vector<cv::Point2f>(4);
+    corners_[0] = cv::Point(0, 0);
+    corners_[1] = cv::Point(img_.cols, 0);
+    corners_[2] = cv::Point(img_.cols, img_.rows);
+    corners_[3] = cv::Point(0, img_.rows);
+    return true;
+}
+
+// Reads the notes described in a manifest file, without reading their images. The image filenames
+// are relative to the directory of the manifest. If with_patches is false, the patches are ignored
+// and the keypoints are detected in the whole images.
+std::vector<NoteImgObject> NoteImgObject::loadManifest(std::string filename, bool with_patches) {
+    std::vector<NoteImgObject> notes;
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        LOG_ERROR("Error reading " << filename << "\n");
+        return notes;
     }
-    return NoteImgObject("10B", "notes/10eu_v.jpg", 10, detector, extractor, patches);
-}
 
-// Creates a NoteImgObject for the 20 euro note (front)
-NoteImgObject NoteImgObject::create20Front(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(4,4,4+26,4+23)); // left top
-        patches.push_back(ImgObject::createPatch(6,109,6+31,109+27)); // left bottom
-        patches.push_back(ImgObject::createPatch(159,5,159+63,5+52)); // right top
-        patches.push_back(ImgObject::createPatch(129,45,129+106,45+92)); // arc
+    std::string directory;
+    size_t separator = filename.find_last_of("/\\");
+    if (separator != std::string::npos) {
+        directory = filename.substr(0, separator + 1);
     }
-    return NoteImgObject("20F", "notes/20eu_r.jpg", 20, detector, extractor, patches);
-}
 
-// Creates a NoteImgObject for the 20 euro note (back)
-NoteImgObject NoteImgObject::create20Back(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(6,3,6+150,3+61)); // left top
-        patches.push_back(ImgObject::createPatch(7,111,7+32,111+29)); // left bottom
-        patches.push_back(ImgObject::createPatch(236,3,236+24,3+26)); // right top
-        patches.push_back(ImgObject::createPatch(232,114,232+28,114+25)); // right bottom
-    }
-    return NoteImgObject("20B", "notes/20eu_v.jpg", 20, detector, extractor, patches);
-}
+    cv::FileNode notes_node = fs["notes"];
+    for (cv::FileNodeIterator it = notes_node.begin(); it != notes_node.end(); ++it) {
+        std::string tag = (std::string) (*it)["tag"];
+        std::string image = (std::string) (*it)["image"];
+        if (tag.empty() || image.empty()) {
+            LOG_ERROR("Note without tag or image in " << filename << "\n");
+            continue;
+        }
 
-// Creates a NoteImgObject for the 50 euro note (front)
-NoteImgObject NoteImgObject::create50Front(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(3,5,3+24,5+23)); // left top
-        patches.push_back(ImgObject::createPatch(3,114,3+32,114+26)); // left bottom
-        patches.push_back(ImgObject::createPatch(166,4,166+64,4+52)); // right top
-        patches.push_back(ImgObject::createPatch(142,26,142+80,26+105)); // arc
-    }
-    return NoteImgObject("50F", "notes/50eu_r.jpg", 50, detector, extractor, patches);
-}
+        std::vector<std::vector<cv::Point2f>> patches;
+        cv::FileNode patches_node = (*it)["patches"];
+        if (with_patches) {
+            for (cv::FileNodeIterator patch = patches_node.begin(); patch != patches_node.end(); ++patch) {
+                std::vector<int> rectangle;
+                (*patch) >> rectangle;
+                if (rectangle.size() == 4) {
+                    patches.push_back(ImgObject::createPatch(rectangle[0], rectangle[1], rectangle[2], rectangle[3]));
+                }
+            }
+        }
 
-// Creates a NoteImgObject for the 50 euro note (back)
-NoteImgObject NoteImgObject::create50Back(bool with_patches, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor) {
-    std::vector<std::vector<cv::Point2f>> patches;
-    if (with_patches) {
-        patches.push_back(ImgObject::createPatch(7,5,7+160,5+57)); // left top
-        patches.push_back(ImgObject::createPatch(8,114,8+36,114+29)); // left bottom
-        patches.push_back(ImgObject::createPatch(237,4,237+24,4+24)); // right top
-        patches.push_back(ImgObject::createPatch(220,111,220+36,111+28)); // right bottom
+        notes.push_back(NoteImgObject(tag, directory + image, (int) (*it)["value"], (std::string) (*it)["series"], patches));
     }
-    return NoteImgObject("50B", "notes/50eu_v.jpg", 50, detector, extractor, patches);
-}
\ No newline at end of file
+    return notes;
+}
@@ -4,37 +4,36 @@
 #include "ImgObject.h"
 
 // Class to represent the note images. Subclass of ImgObject.
+// The notes are described in a manifest file and their images are only read when they are first used.
+// Copies of a note share its image, so the same notes can be used by several detectors.
 class NoteImgObject : public ImgObject {
 private:
     std::string tag_;
     int value_;
+    std::string series_;
     std::vector<std::vector<cv::Point2f>> patches_;
     std::vector<cv::Point2f> corners_;
+    ColorSignature color_signature_;
 public:
     NoteImgObject(void);
-    NoteImgObject(std::string tag, std::string filename, int value = 0, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL, std::vector<std::vector<cv::Point2f>> patches = std::vector<std::vector<cv::Point2f>>());
+    NoteImgObject(const std::string& tag, const std::string& filename, int value = 0, const std::string& series = "",
+        const std::vector<std::vector<cv::Point2f>>& patches = std::vector<std::vector<cv::Point2f>>());
     ~NoteImgObject(void);
     
     void setTag(std::string tag);
-    std::string getTag();
+    const std::string& getTag();
 
     void setValue(int value);
     int getValue();
     std::vector<cv::Point2f>& getCorners();
+    std::vector<std::vector<cv::Point2f>>& getPatches();
+    const ColorSignature& getColorSignature();
 
-    void selectKeyPoints(std::vector<cv::KeyPoint> keypoints);
-    void detectKeypoints(cv::FeatureDetector* detector);
+    std::string getSeries();
+    bool isLoaded();
+    bool load();
 
-    static NoteImgObject create5Front(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create5NFront(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create5Back(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create5NBack(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create10Front(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create10Back(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create20Front(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create20Back(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create50Front(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
-    static NoteImgObject create50Back(bool with_patches, cv::FeatureDetector* detector = NULL, cv::DescriptorExtractor* extractor = NULL);
+    static std::vector<NoteImgObject> loadManifest(std::string filename, bool with_patches);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <sstream>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
+
+#include "NoteTracker.h"
+#include "HomographyEstimator.h"
+
+#include "Log.h"
+
+// Minimum number of tracked points to compute the homography of a note
+#define MIN_TRACKED_POINTS 8
+
+NoteTracker::NoteTracker(ObjectDetector& object_detector, int keyframe_interval, double min_tracked_ratio) :
+    object_detector_(object_detector), frames_since_keyframe_(0) {
+    keyframe_interval_ = keyframe_interval;
+    min_tracked_ratio_ = min_tracked_ratio;
+}
+
+NoteTracker::~NoteTracker(void) {}
+
+// Finds all the notes in the frame with the object detector
+void NoteTracker::detect(const cv::Mat& frame) {
+    ImgObject scene(frame);
+    object_detector_.computeScene(scene);
+    std::vector<FoundObject> objects_found = object_detector_.findAllObjects(scene, false);
+
+    tracked_objects_.clear();
+    for (unsigned int i = 0; i < objects_found.size(); ++i) {
+        tracked_objects_.push_back(TrackedObject(objects_found[i]));
+    }
+    frames_since_keyframe_ = 0;
+}
+
+// Moves the notes from the previous frame to the given one. Returns false if any of them was lost.
+bool NoteTracker::track(const cv::Mat& frame) {
+    // the inliers of all the notes are tracked at once
+    std::vector<cv::Point2f> previous_points, next_points;
+    std::vector<int> first_point(tracked_objects_.size() + 1, 0);
+    for (unsigned int i = 0; i < tracked_objects_.size(); ++i) {
+        std::vector<cv::Point2f>& inliers = tracked_objects_[i].found_object_.inliers_;
+        previous_points.insert(previous_points.end(), inliers.begin(), inliers.end());
+        first_point[i + 1] = (int) previous_points.size();
+    }
+    if (previous_points.empty()) {
+        return true;
+    }
+
+    std::vector<uchar> status;
+    std::vector<float> error;
+    cv::calcOpticalFlowPyrLK(previous_frame_, frame, previous_points, next_points, status, error);
+
+    HomographyEstimator homography_estimator(3);
+    for (unsigned int i = 0; i < tracked_objects_.size(); ++i) {
+        TrackedObject& tracked = tracked_objects_[i];
+        std::vector<cv::Point2f> from, to;
+        for (int j = first_point[i]; j < first_point[i + 1]; ++j) {
+            if (status[j]) {
+                from.push_back(previous_points[j]);
+                to.push_back(next_points[j]);
+            }
+        }
+
+        cv::Mat homography;
+        std::vector<int> inliers;
+        if ((int) from.size() < MIN_TRACKED_POINTS || !homography_estimator.estimate(from, to, homography, inliers)
+            || inliers.size() < min_tracked_ratio_ * tracked.detected_inliers_) {
+            LOG_DEBUG("Lost " << tracked.found_object_.tag_ << ": " << inliers.size() << " of " << tracked.detected_inliers_ << " inliers\n");
+            return false;
+        }
+
+        std::vector<cv::Point2f> countour;
+        cv::perspectiveTransform(tracked.found_object_.countour_, countour, homography);
+        tracked.found_object_.countour_ = countour;
+        tracked.found_object_.inliers_.resize(inliers.size());
+        for (unsigned int j = 0; j < inliers.size(); ++j) {
+            tracked.found_object_.inliers_[j] = to[inliers[j]];
+        }
+    }
+    return true;
+}
+
+// Finds the notes in the next frame (in grayscale) of the sequence. keyframe is set to true if they were detected
+// instead of tracked from the previous frame.
+std::vector<FoundObject> NoteTracker::process(const cv::Mat& frame, bool* keyframe) {
+    bool detected = previous_frame_.empty() || frames_since_keyframe_ + 1 >= keyframe_interval_ || !track(frame);
+    if (detected) {
+        detect(frame);
+    } else {
+        ++frames_since_keyframe_;
+    }
+    previous_frame_ = frame;
+
+    if (keyframe != NULL) {
+        *keyframe = detected;
+    }
+
+    std::vector<FoundObject> objects_found;
+    for (unsigned int i = 0; i < tracked_objects_.size(); ++i) {
+        objects_found.push_back(tracked_objects_[i].found_object_);
+    }
+    return objects_found;
+}
+
+// Processes all the frames of a video file or image sequence (e.g. "frames/%04d.jpg"),
+// giving the notes of each frame to sink. Returns false if the source can't be opened.
+bool NoteTracker::run(std::string source, ResultSink& sink) {
+    cv::VideoCapture capture(source);
+    if (!capture.isOpened()) {
+        LOG_ERROR("Unable to open " << source << "\n");
+        return false;
+    }
+
+    cv::Mat frame;
+    for (int n = 0; capture.read(frame); ++n) {
+        cv::Mat gray;
+        if (frame.channels() == 1) {
+            gray = frame.clone();
+        } else {
+            cv::cvtColor(frame, gray, CV_BGR2GRAY);
+        }
+
+        bool keyframe;
+        std::vector<FoundObject> objects_found = process(gray, &keyframe);
+
+        std::stringstream ss;
+        ss << source << "#" << n << (keyframe ? " (keyframe)" : "");
+        sink.write(ss.str(), gray, objects_found);
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef NOTE_TRACKER_H
+#define NOTE_TRACKER_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "ObjectDetector.h"
+#include "ResultSink.h"
+
+// A note followed between frames, with the number of inliers it had when it was detected
+struct TrackedObject {
+    TrackedObject(FoundObject found_object) : found_object_(found_object), detected_inliers_((int) found_object.inliers_.size()) {};
+    FoundObject found_object_;
+    int detected_inliers_;
+};
+
+// Follows the notes in a sequence of frames, such as a video file or numbered images.
+// The notes are only detected in keyframes; in the other frames each contour is moved with the homography
+// given by the optical flow of its inliers. A new detection is made when too many of them are lost.
+class NoteTracker {
+private:
+    ObjectDetector& object_detector_;
+    int keyframe_interval_;
+    double min_tracked_ratio_;
+
+    cv::Mat previous_frame_;
+    std::vector<TrackedObject> tracked_objects_;
+    int frames_since_keyframe_;
+
+    void detect(const cv::Mat& frame);
+    bool track(const cv::Mat& frame);
+public:
+    NoteTracker(ObjectDetector& object_detector, int keyframe_interval = 30, double min_tracked_ratio = 0.5);
+    ~NoteTracker(void);
+
+    std::vector<FoundObject> process(const cv::Mat& frame, bool* keyframe = NULL);
+    bool run(std::string source, ResultSink& sink);
+};
+
+#endif
@@ -1,64 +1,247 @@
 #include <iostream>
-#include <sstream>
+#include <algorithm>
 
 #include "opencv2/calib3d/calib3d.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 
 #include "ObjectDetector.h"
+#include "HomographyEstimator.h"
+#include "ResultSink.h"
+#include "AllocationCounter.h"
 
 #include "Log.h"
 
-#define FONT_FACE cv::FONT_HERSHEY_SCRIPT_COMPLEX
-#define FONT_THICKNESS 3
-#define FONT_RATIO 4
+// Smallest fraction of a scene, or of a proposed region, covered by a note for the color filter
+#define COLOR_MIN_AREA 0.02
 
-ObjectDetector::ObjectDetector() {}
+// Nearest library descriptors looked up for each scene keypoint
+#define MATCH_NEIGHBOURS 2
+// A scene keypoint is also matched with a further neighbour of another note if the nearest distance
+// is at least this fraction of the neighbour's distance
+#define SHARED_MATCH_RATIO 0.8
 
-ObjectDetector::ObjectDetector(std::string scene_filename, cv::FeatureDetector* feature_detector, 
-        cv::DescriptorExtractor* descriptor_extractor,
-        cv::DescriptorMatcher* descriptor_matcher) {
+// Scenes whose features are kept in memory for each detector, besides the notes of the library
+#define MEMORY_CACHE_SCENES 16
+
+// Adds an object to objects_found, reusing the buffers of a spare one if there is any
+FoundObject& IterationWorkspace::addFoundObject(std::vector<FoundObject>& objects_found) {
+    objects_found.push_back(FoundObject());
+    if (!spare_objects_.empty()) {
+        objects_found.back().swap(spare_objects_.back());
+        spare_objects_.pop_back();
+    }
+    return objects_found.back();
+}
+
+// Empties objects_found, keeping its objects as spares. They are kept in reverse order, so the next objects
+// found get the buffers of the previous ones in the same order, which are already large enough for a similar scene.
+void IterationWorkspace::recycle(std::vector<FoundObject>& objects_found) {
+    for (int i = (int) objects_found.size() - 1; i >= 0; --i) {
+        spare_objects_.push_back(FoundObject());
+        spare_objects_.back().swap(objects_found[i]);
+    }
+    objects_found.clear();
+}
+
+ObjectDetector::ObjectDetector() : hamming_matcher_(NULL), detector_key_(0), extractor_key_(0), reuse_scene_features_(false), parallel_search_(false), max_dimension_(0), refine_max_dimension_(0), region_proposals_(false), color_filter_(false), tile_size_(0), tile_overlap_(0), shortlist_size_(0), stage_times_(NULL), scenes_(NULL) {
+    std::fill(stage_histograms_, stage_histograms_ + STAGE_COUNT, (Histogram*) NULL);
+}
+
+ObjectDetector::ObjectDetector(cv::FeatureDetector* feature_detector, cv::DescriptorExtractor* descriptor_extractor,
+        cv::DescriptorMatcher* descriptor_matcher) : detector_key_(0), extractor_key_(0), reuse_scene_features_(false), parallel_search_(false), max_dimension_(0), refine_max_dimension_(0), region_proposals_(false), color_filter_(false), tile_size_(0), tile_overlap_(0), shortlist_size_(0), stage_times_(NULL), scenes_(NULL) {
          
     feature_detector_ = feature_detector;
     descriptor_extractor_ = descriptor_extractor;
     descriptor_matcher_ = descriptor_matcher;
-
-    scene_ = ImgObject(scene_filename, feature_detector_, descriptor_extractor_);
+    hamming_matcher_ = dynamic_cast<HammingMatcher*>(descriptor_matcher);
+    std::fill(stage_histograms_, stage_histograms_ + STAGE_COUNT, (Histogram*) NULL);
 }
 
 ObjectDetector::~ObjectDetector(void) {}
 
+// Sets the directory where the library features are cached. An empty directory disables the cache.
+void ObjectDetector::setCacheDirectory(std::string directory) {
+    feature_cache_.setDirectory(directory);
+}
+
+// If parallel_search is true, the notes of the library are searched concurrently in each scene.
+// Only used when the iterations are not shown.
+void ObjectDetector::setParallelSearch(bool parallel_search) {
+    parallel_search_ = parallel_search;
+}
+
+// Searches the notes in a reduced scene whose largest side is at most max_dimension (0 uses the full scene).
+// If refine_max_dimension isn't 0, each note found is searched again in its region of the full scene,
+// reduced to at most refine_max_dimension, to get a more accurate contour.
+void ObjectDetector::setPyramid(int max_dimension, int refine_max_dimension) {
+    max_dimension_ = max_dimension;
+    refine_max_dimension_ = refine_max_dimension;
+}
+
+// If region_proposals is true, the regions of each scene that may have notes are found first, and the notes
+// are only searched inside them. The whole scene is searched if no region is found.
+void ObjectDetector::setRegionProposals(bool region_proposals) {
+    region_proposals_ = region_proposals;
+}
+
+// If color_filter is true, the notes whose colors are not in a scene are not searched in it. The scenes must be
+// read with their color copy (see hasColorFilter); the notes are always searched in scenes without it.
+void ObjectDetector::setColorFilter(bool color_filter) {
+    color_filter_ = color_filter;
+}
+
+// True if the scenes should be read in color, for the color filter
+bool ObjectDetector::hasColorFilter() {
+    return color_filter_;
+}
+
+// True if the matcher reuses the buffers of the workspace, so searching a scene doesn't allocate memory once
+// they have grown. The other matchers of OpenCV allocate their results on each search.
+bool ObjectDetector::hasReusableMatcher() {
+    return hamming_matcher_ != NULL;
+}
+
+// Detects and describes the scenes larger than tile_size in tiles of about tile_size pixels, searched concurrently.
+// Each tile is processed with overlap pixels around it, which should be larger than the keypoint neighbourhoods
+// of the algorithms. A tile_size of 0 processes the whole scene at once.
+void ObjectDetector::setTiling(int tile_size, int overlap) {
+    tile_size_ = tile_size;
+    tile_overlap_ = overlap;
+}
+
+// If reuse_scene_features is true, the features of a scene are kept in memory, so another combination of algorithms
+// with the same detector, or the same detector and extractor, doesn't compute them again for the same scene.
+// Only useful when the same scene is searched with several combinations; the notes always reuse their features.
+void ObjectDetector::setReuseSceneFeatures(bool reuse_scene_features) {
+    reuse_scene_features_ = reuse_scene_features;
+}
+
+// Searches in each scene, or proposed region, only the shortlist_size notes of the library that are most similar
+// to it according to the bag of visual words index. The vocabulary for the current algorithms is read from filename
+// by computeAll; without it, or with a shortlist_size of 0, all the notes are searched.
+void ObjectDetector::setVocabulary(std::string filename, int shortlist_size) {
+    vocabulary_filename_ = filename;
+    shortlist_size_ = shortlist_size;
+}
+
+// Trains a vocabulary of the given number of words from the library descriptors of the current algorithms and writes
+// it in fs, in the node read by computeAll for the same algorithms. Returns false if the library has no descriptors.
+bool ObjectDetector::trainVocabulary(cv::FileStorage& fs, int words) {
+    std::vector<cv::Mat> descriptors;
+    for (unsigned int i = 0; i < object_library_.size(); ++i) {
+        descriptors.push_back(object_library_[i].getDescriptors());
+    }
+    VocabularyIndex vocabulary;
+    if (!vocabulary.train(descriptors, words)) {
+        return false;
+    }
+    vocabulary.write(fs, VocabularyIndex::getNodeName(feature_detector_, descriptor_extractor_));
+    return true;
+}
+
+// Adds the time spent in each stage of the detection to stage_times. NULL disables the timing.
+void ObjectDetector::setStageTimes(StageTimes* stage_times) {
+    stage_times_ = stage_times;
+}
+
+// Name of the combination of algorithms, used to label the metrics
+void ObjectDetector::setCombinationName(std::string combination_name) {
+    combination_name_ = combination_name;
+    updateMetrics();
+}
+
+// Gets the metrics of the notes of the library and of the stages for the current combination.
+// They are kept, so the search only has to increment them. Nothing is registered until the combination
+// is named, so no metrics are exported without a combination label.
+void ObjectDetector::updateMetrics() {
+    if (combination_name_.empty()) {
+        std::fill(stage_histograms_, stage_histograms_ + STAGE_COUNT, (Histogram*) NULL);
+        scenes_ = NULL;
+        note_metrics_.clear();
+        return;
+    }
+    Metrics& metrics = Metrics::instance();
+    std::string combination = Metrics::labels("combination", combination_name_);
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        stage_histograms_[i] = i == STAGE_IMREAD ? NULL : metrics.histogram("notedetector_stage_seconds", "Time spent in each stage of the detection",
+            Metrics::labels("stage", StageTimes::getStageName(i), "combination", combination_name_));
+    }
+    scenes_ = metrics.counter("notedetector_scenes_total", "Scenes searched", combination);
+
+    note_metrics_.resize(object_library_.size());
+    for (unsigned int i = 0; i < object_library_.size(); ++i) {
+        std::string labels = Metrics::labels("note", object_library_[i].getTag(), "combination", combination_name_);
+        NoteMetrics& note_metrics = note_metrics_[i];
+        note_metrics.matches_ = metrics.counter("notedetector_matches_total", "Matches examined by the iterations of the search of a note", labels);
+        note_metrics.good_matches_ = metrics.counter("notedetector_good_matches_total", "Matches kept by the distance filter", labels);
+        note_metrics.inliers_ = metrics.counter("notedetector_inliers_total", "Inliers of the homographies found", labels);
+        note_metrics.homography_failures_ = metrics.counter("notedetector_homography_failures_total",
+            "Iterations where no homography was found", labels);
+        note_metrics.outside_contour_ = metrics.counter("notedetector_inlier_outside_contour_total",
+            "Homographies rejected because an inlier was outside the note contour", labels);
+        note_metrics.found_ = metrics.counter("notedetector_notes_found_total", "Notes found", labels);
+        note_metrics.color_rejections_ = metrics.counter("notedetector_color_rejections_total",
+            "Scenes where the note wasn't searched because its colors were missing", labels);
+        note_metrics.shortlist_rejections_ = metrics.counter("notedetector_shortlist_rejections_total",
+            "Scenes where the note wasn't searched because it wasn't in the vocabulary shortlist", labels);
+    }
+}
+
+// Metrics of a note of the library, or NULL if the note isn't in the library
+NoteMetrics* ObjectDetector::getNoteMetrics(NoteImgObject& object) {
+    if (object_library_.empty() || &object < &object_library_[0] || &object >= &object_library_[0] + note_metrics_.size()) {
+        return NULL;
+    }
+    return &note_metrics_[&object - &object_library_[0]];
+}
+
+
+// Loads the notes described in a manifest file. Their images are only read, and their features computed,
+// when they are first used by computeAll. Returns false if there are no notes.
+bool ObjectDetector::loadLibrary(std::string manifest, bool with_patches) {
+    object_library_ = NoteImgObject::loadManifest(manifest, with_patches);
+    // the features of every note are kept for each detector, so a sweep over the combinations never computes them twice
+    memory_cache_.setMaxImages(object_library_.size() + MEMORY_CACHE_SCENES);
+    updateMetrics();
+    return !object_library_.empty();
+}
+
+// Features kept in memory across the combinations of algorithms, with the number of lookups that found them
+const MemoryFeatureCache& ObjectDetector::getMemoryCache() {
+    return memory_cache_;
+}
 
-// Load all notes
-void ObjectDetector::loadLibrary(bool with_patches) {
-    object_library_.push_back(NoteImgObject::create5Front(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create5Back(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create5NFront(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create5NBack(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create10Front(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create10Back(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create20Front(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create20Back(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create50Front(with_patches, feature_detector_, descriptor_extractor_));
-    object_library_.push_back(NoteImgObject::create50Back(with_patches, feature_detector_, descriptor_extractor_));
+// Returns the image filenames of the notes in the library
+std::vector<std::string> ObjectDetector::getLibraryFilenames() {
+    std::vector<std::string> filenames;
+    for (unsigned int i = 0; i < object_library_.size(); ++i) {
+        filenames.push_back(object_library_[i].getFilename());
+    }
+    return filenames;
 }
 
-// An iteration to detect a certain note. Returns true if the note is found.
+// An iteration to detect a certain note in the scene. Returns true if the note is found,
+// in which case it is added to objects_found.
+// matches are the matches between the note (query) and the scene (train) keypoints that were not
+// used yet by another note of the same kind, which are the ones active in active_keypoints.
+// The buffers of workspace are reused by all the iterations.
+// The matches, inliers and notes found are counted in note_metrics, unless it is NULL.
 // If wait is true, the iteration results will be shown in a window
-bool ObjectDetector::iterate(bool wait) {
-    if (scene_.getDescriptors().rows == 0) {
-        Log::instance().debug("\tNo descriptors left.\n__________________________________________________________________________\n");
+bool ObjectDetector::iterate(ImgObject& scene, KeypointMask& active_keypoints, NoteImgObject& object, std::vector<cv::DMatch>& matches,
+                             std::vector<FoundObject>& objects_found, IterationWorkspace& workspace, NoteMetrics* note_metrics, bool wait) {
+    if (matches.empty()) {
+        LOG_DEBUG("\tNo descriptors left.\n__________________________________________________________________________\n");
         return false;
     }
 
-    std::vector<cv::DMatch> matches, good_matches;
+    std::vector<cv::DMatch>& good_matches = workspace.good_matches_;
+    good_matches.clear();
+    if (note_metrics != NULL) {
+        note_metrics->matches_->increment(matches.size());
+    }
     
-    // compute the matches
-    descriptor_matcher_->match(object_->getDescriptors(), scene_.getDescriptors(), matches);
-    std::stringstream ss;
-    ss << "\tMatches: " << matches.size() << "\n";
-    Log::instance().debug(ss.str());
-    ss.str("");
+    LOG_DEBUG("\tMatches: " << matches.size() << "\n");
     double max_dist = 0;
     double min_dist = 100;
     for(unsigned int i = 0; i < matches.size(); ++i) {
@@ -78,18 +261,18 @@ bool ObjectDetector::iterate(bool wait) {
         }
     }
 
-    ss << "\tGood matches: " << good_matches.size() << "\n";
-    Log::instance().debug(ss.str());
-    ss.str("");
+    LOG_DEBUG("\tGood matches: " << good_matches.size() << "\n");
+    if (note_metrics != NULL) {
+        note_metrics->good_matches_->increment(good_matches.size());
+    }
 
     if(good_matches.size() < 4) {
-        ss << "\tNeeded 4 points to calculate homography. Have " << good_matches.size()
-           << "\n__________________________________________________________________________\n";
-        Log::instance().debug(ss.str());
-        ss.str("");
+        LOG_DEBUG("\tNeeded 4 points to calculate homography. Have " << good_matches.size()
+                  << "\n__________________________________________________________________________\n");
         cv::Mat img_matches;
         if (wait) {
-            drawMatches( object_->getImg(), object_->getKeypoints(), scene_.getImg(), scene_.getKeypoints(),
+            ScopedStageTimer timer(stage_times_, STAGE_DRAWING, stage_histograms_[STAGE_DRAWING]);
+            drawMatches( object.getImg(), object.getKeypoints(), scene.getImg(), scene.getKeypoints(),
                 good_matches, img_matches,cv::Scalar::all(-1), cv::Scalar(0,0,255));
             cv::imshow(used_algorithms_ + " - Iteration", img_matches);
             cv::waitKey(0);
@@ -98,47 +281,68 @@ bool ObjectDetector::iterate(bool wait) {
         return false;
     }
 
+    // the best matches come first, so the homography estimation tries them first
+    std::sort(good_matches.begin(), good_matches.end());
+
     // get the points in the scene image and note image from the matches to compute the homography
-    std::vector<cv::Point2f> points_obj, points_scene;
+    std::vector<cv::Point2f>& points_obj = workspace.points_obj_;
+    std::vector<cv::Point2f>& points_scene = workspace.points_scene_;
+    points_obj.clear();
+    points_scene.clear();
     for(unsigned int i = 0; i < good_matches.size(); ++i) {
-        points_obj.push_back(object_->getKeypoints()[good_matches[i].queryIdx].pt);
-        points_scene.push_back(scene_.getKeypoints()[good_matches[i].trainIdx].pt);
+        points_obj.push_back(object.getKeypoints()[good_matches[i].queryIdx].pt);
+        points_scene.push_back(scene.getKeypoints()[good_matches[i].trainIdx].pt);
     }
 
-    // computes the homography, and information about its inliers is kept in the inliers matrix
-    cv::Mat inliers;
-    cv::Mat homography = cv::findHomography(points_obj, points_scene, cv::RANSAC, 3, inliers);
-
-    std::vector<cv::DMatch> inlier_matches;
-    std::vector<cv::Point2f> inlier_points;
-    for(int i = 0; i < inliers.rows; ++i) {
-        // if the first position in the ith row of the inliers matrix is different than zero, then the scene image point in good_matches[i] is an inlier
-        if(inliers.at<uchar>(i, 0) != 0) {
-            inlier_matches.push_back(good_matches[i]);
-            cv::Point2f point = scene_.getKeypoints()[good_matches[i].trainIdx].pt; 
-            inlier_points.push_back(point);
+    // computes the homography, and the indices of its inliers in good_matches
+    cv::Mat homography;
+    std::vector<int>& inliers = workspace.inliers_;
+    bool estimated;
+    {
+        ScopedStageTimer timer(stage_times_, STAGE_HOMOGRAPHY, stage_histograms_[STAGE_HOMOGRAPHY]);
+        estimated = workspace.homography_estimator_.estimate(points_obj, points_scene, homography, inliers);
+    }
+    if (!estimated) {
+        if (note_metrics != NULL) {
+            note_metrics->homography_failures_->increment();
         }
+        LOG_DEBUG("\tHomography not found\n__________________________________________________________________________\n");
+        return false;
     }
 
-    ss << "\tInlier points: " << inlier_points.size() << "\n";
-    Log::instance().debug(ss.str());
-    ss.str("");
+    std::vector<cv::Point2f>& inlier_points = workspace.inlier_points_;
+    inlier_points.clear();
+    for(unsigned int i = 0; i < inliers.size(); ++i) {
+        inlier_points.push_back(points_scene[inliers[i]]);
+    }
 
-    cv::Mat img_matches;
-    drawMatches(object_->getImg(), object_->getKeypoints(), scene_.getImg(), scene_.getKeypoints(),
-        inlier_matches, img_matches,cv::Scalar::all(-1), cv::Scalar(0,0,255));
+    LOG_DEBUG("\tInlier points: " << inlier_points.size() << "\n");
+    if (note_metrics != NULL) {
+        note_metrics->inliers_->increment(inlier_points.size());
+    }
 
     // the homography is applied to the corners of the note image
-    std::vector<cv::Point2f> scene_corners(4);
-    cv::perspectiveTransform(object_->getCorners(), scene_corners, homography);
-
-    cv::Point2f offset((float) object_->getImg().cols, 0);
-    line(img_matches, scene_corners[0] + offset, scene_corners[1] + offset, cv::Scalar(0, 255, 0), 4 );
-    line(img_matches, scene_corners[1] + offset, scene_corners[2] + offset, cv::Scalar(0, 255, 0), 4 );
-    line(img_matches, scene_corners[2] + offset, scene_corners[3] + offset, cv::Scalar(0, 255, 0), 4 );
-    line(img_matches, scene_corners[3] + offset, scene_corners[0] + offset, cv::Scalar(0, 255, 0), 4 );
+    std::vector<cv::Point2f>& scene_corners = workspace.scene_corners_;
+    scene_corners.resize(4);
+    cv::perspectiveTransform(object.getCorners(), scene_corners, homography);
 
+    // the iterations are only drawn when they are shown
     if (wait) {
+        ScopedStageTimer timer(stage_times_, STAGE_DRAWING, stage_histograms_[STAGE_DRAWING]);
+        std::vector<cv::DMatch> inlier_matches;
+        for(unsigned int i = 0; i < inliers.size(); ++i) {
+            inlier_matches.push_back(good_matches[inliers[i]]);
+        }
+        cv::Mat img_matches;
+        drawMatches(object.getImg(), object.getKeypoints(), scene.getImg(), scene.getKeypoints(),
+            inlier_matches, img_matches,cv::Scalar::all(-1), cv::Scalar(0,0,255));
+
+        cv::Point2f offset((float) object.getImg().cols, 0);
+        line(img_matches, scene_corners[0] + offset, scene_corners[1] + offset, cv::Scalar(0, 255, 0), 4 );
+        line(img_matches, scene_corners[1] + offset, scene_corners[2] + offset, cv::Scalar(0, 255, 0), 4 );
+        line(img_matches, scene_corners[2] + offset, scene_corners[3] + offset, cv::Scalar(0, 255, 0), 4 );
+        line(img_matches, scene_corners[3] + offset, scene_corners[0] + offset, cv::Scalar(0, 255, 0), 4 );
+
         imshow(used_algorithms_ + " - Iteration", img_matches);
         cv::waitKey(0);
     }
@@ -146,118 +350,645 @@ bool ObjectDetector::iterate(bool wait) {
     // if at least one of the inliers is not in the area delimited by the note image contours when the homography is applied,
     // then the scene image does not have images of the note
     if(!allPointsInsideCountour(scene_corners, inlier_points)) {
-        Log::instance().debug("\tInlier outside contour\n__________________________________________________________________________\n");
+        if (note_metrics != NULL) {
+            note_metrics->outside_contour_->increment();
+        }
+        LOG_DEBUG("\tInlier outside contour\n__________________________________________________________________________\n");
         return false;
     }
 
-    // remove the keypoints inside the countours given by the note image in the scene object to find other notes of the same kind in the next iteration
-    scene_.removeKeypointsInsideCountour(scene_corners);
+    // remove the keypoints inside the countours given by the note image in the scene object, and the matches
+    // that use them, to find other notes of the same kind in the next iteration
+    {
+        ScopedStageTimer timer(stage_times_, STAGE_REMOVAL, stage_histograms_[STAGE_REMOVAL]);
+        scene.removeKeypointsInsideCountour(scene_corners, active_keypoints);
+        removeInactiveMatches(active_keypoints, matches);
+    }
 
-    // saves the information about the note found
-    objects_found_.push_back(FoundObject(scene_corners, object_->getValue(), object_->getTag()));
+    // saves the information about the note found, in the buffers of a previous one
+    FoundObject& found_object = workspace.addFoundObject(objects_found);
+    found_object.countour_.assign(scene_corners.begin(), scene_corners.end());
+    found_object.value_ = object.getValue();
+    found_object.tag_ = object.getTag();
+    found_object.inliers_.assign(inlier_points.begin(), inlier_points.end());
+    if (note_metrics != NULL) {
+        note_metrics->found_->increment();
+    }
 
-    Log::instance().debug("\tFound: " + object_->getTag() + "\n__________________________________________________________________________\n");
+    LOG_DEBUG("\tFound: " << object.getTag() << "\n__________________________________________________________________________\n");
 
     return true;
 }
 
-// find all the notes in the library
-void ObjectDetector::findAllObjects(bool wait) {
-    // for each note in the library
-    for(unsigned int i = 0; i < object_library_.size(); ++i) {
-        object_ = &object_library_[i];
-        Log::instance().debug(object_->getTag() + "\n");
-        // iterate while the note is found in the scene image 
-        while(iterate(wait));
-        // when all notes of the same type are found, reset the keypoints
-        scene_.resetKeypoints();
+namespace {
+
+// Orders the matches of a note by note keypoint, and the matches of each note keypoint from the nearest
+bool isNearerInRow(const cv::DMatch& a, const cv::DMatch& b) {
+    if (a.queryIdx != b.queryIdx) {
+        return a.queryIdx < b.queryIdx;
+    }
+    if (a.distance != b.distance) {
+        return a.distance < b.distance;
     }
+    return a.trainIdx < b.trainIdx;
+}
 
-    cv::Mat img_to_show;
-    int total = 0;
-    cv::cvtColor(scene_.getImg(), img_to_show, CV_GRAY2RGB);
-    // draw the found notes in the scene image
-    for(unsigned int i = 0; i < objects_found_.size(); ++i) {
-        drawFoundObject(img_to_show, objects_found_[i]);
-        total += objects_found_[i].value_;
+// Keeps only the nearest scene keypoint of each note keypoint among the matches of a note. Since every scene
+// keypoint only has matches with its nearest library descriptors, the matches left are mutual, as the ones of
+// a cross checked matcher. The matches are sorted in place, so no memory is allocated.
+void keepMutualMatches(std::vector<cv::DMatch>& matches) {
+    std::sort(matches.begin(), matches.end(), isNearerInRow);
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < matches.size(); ++i) {
+        if (i == 0 || matches[i].queryIdx != matches[i - 1].queryIdx) {
+            matches[kept++] = matches[i];
+        }
+    }
+    matches.resize(kept);
+}
+
+}
+
+// Matches the scene descriptors once against the whole library and splits the matches by note in the
+// library_matches_ of workspace. The scene descriptors are the query of the matcher, so each scene keypoint
+// gets the MATCH_NEIGHBOURS nearest descriptors of the whole library: the nearest one is always kept, and
+// each further one only if it belongs to a note not matched yet and is almost as near (SHARED_MATCH_RATIO).
+// That way a keypoint in a part that similar notes share is kept for all of them instead of only for the
+// nearest one. In library_matches_ the note keypoints are the query and the scene keypoints the train,
+// as iterate expects. With a HammingMatcher, the notes that are not candidates are not matched at all,
+// so the neighbours are the nearest among the candidates, and if it cross checks, only the mutual matches
+// of each note are kept, as the single note matching with a cross checked BFMatcher did.
+void ObjectDetector::matchLibrary(ImgObject& scene, DetectionWorkspace& workspace) {
+    ScopedStageTimer timer(stage_times_, STAGE_MATCH, stage_histograms_[STAGE_MATCH]);
+    std::vector<std::vector<cv::DMatch>>& library_matches = workspace.library_matches_;
+    library_matches.resize(object_library_.size());
+    for (unsigned int i = 0; i < library_matches.size(); ++i) {
+        library_matches[i].clear();
+    }
+    if (scene.getDescriptors().rows == 0 || index_notes_.empty()) {
+        return;
+    }
+
+    std::vector<std::vector<cv::DMatch>>& matches = workspace.matches_;
+    if (hamming_matcher_ != NULL) {
+        // the images of the matcher of the notes left out by selectCandidates are skipped
+        std::vector<char>& train_images = workspace.train_images_;
+        train_images.resize(index_notes_.size());
+        for (unsigned int i = 0; i < index_notes_.size(); ++i) {
+            train_images[i] = workspace.candidates_[index_notes_[i]];
+        }
+        hamming_matcher_->knnMatch(scene.getDescriptors(), matches, MATCH_NEIGHBOURS, train_images, workspace.hamming_);
+    } else {
+        descriptor_matcher_->knnMatch(scene.getDescriptors(), matches, MATCH_NEIGHBOURS);
+    }
+
+    for (unsigned int i = 0; i < matches.size(); ++i) {
+        // keypoints removed from the scene are not used
+        if (matches[i].empty() || !scene.isActive(matches[i][0].queryIdx)) {
+            continue;
+        }
+        const cv::DMatch& nearest = matches[i][0];
+        for (unsigned int j = 0; j < matches[i].size(); ++j) {
+            const cv::DMatch& match = matches[i][j];
+            int note = index_notes_[match.imgIdx];
+            if (j > 0) {
+                if (nearest.distance < SHARED_MATCH_RATIO * match.distance) {
+                    break;
+                }
+                bool matched = false;
+                for (unsigned int previous = 0; previous < j && !matched; ++previous) {
+                    matched = index_notes_[matches[i][previous].imgIdx] == note;
+                }
+                if (matched) {
+                    continue;
+                }
+            }
+            library_matches[note].push_back(cv::DMatch(match.trainIdx, match.queryIdx, match.distance));
+        }
+    }
+
+    if (hamming_matcher_ != NULL && hamming_matcher_->isCrossCheck()) {
+        for (unsigned int i = 0; i < library_matches.size(); ++i) {
+            keepMutualMatches(library_matches[i]);
+        }
+    }
+}
+
+// Selects in workspace the notes of the library that are searched in the scene: with the color filter, the notes
+// whose colors can't be explained by the colors of the scene are left out, and with a vocabulary, only the most
+// similar of the remaining notes are kept. Returns false if no note is left.
+bool ObjectDetector::selectCandidates(ImgObject& scene, DetectionWorkspace& workspace) {
+    std::vector<char>& candidates = workspace.candidates_;
+    candidates.assign(object_library_.size(), 1);
+    if (color_filter_ && !scene.getColor().empty()) {
+        workspace.scene_signature_.compute(scene.getColor());
+        for (unsigned int i = 0; i < object_library_.size(); ++i) {
+            candidates[i] = object_library_[i].getColorSignature().isPlausibleIn(workspace.scene_signature_, COLOR_MIN_AREA);
+            if (!candidates[i]) {
+                LOG_DEBUG(object_library_[i].getTag() << ": colors not in the scene\n");
+                if (i < note_metrics_.size()) {
+                    note_metrics_[i].color_rejections_->increment();
+                }
+            }
+        }
+    }
+    shortlist(scene, workspace);
+    return std::find(candidates.begin(), candidates.end(), 1) != candidates.end();
+}
+
+// Keeps as candidates only the shortlist_size_ candidate notes with the best scores in the vocabulary index.
+// The notes without any visual word in common with the scene are left out as well.
+void ObjectDetector::shortlist(ImgObject& scene, DetectionWorkspace& workspace) {
+    if (shortlist_size_ <= 0 || vocabulary_index_.empty() || scene.getDescriptors().rows == 0) {
+        return;
+    }
+
+    std::vector<char>& candidates = workspace.candidates_;
+    std::vector<int>& ranking = workspace.ranking_;
+    ranking.clear();
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        if (candidates[i]) {
+            ranking.push_back(i);
+        }
+    }
+    if ((int) ranking.size() <= shortlist_size_) {
+        return;
+    }
+
+    std::vector<float>& scores = workspace.scores_;
+    {
+        ScopedStageTimer timer(stage_times_, STAGE_MATCH, stage_histograms_[STAGE_MATCH]);
+        vocabulary_index_.score(scene.getDescriptors(), workspace.words_, scores);
+    }
+    // the best notes first, and the notes with the same score in the library order
+    std::stable_sort(ranking.begin(), ranking.end(), [&scores](int a, int b) { return scores[a] > scores[b]; });
+    for (unsigned int i = 0; i < ranking.size(); ++i) {
+        int note = ranking[i];
+        if ((int) i < shortlist_size_ && scores[note] > 0) {
+            LOG_DEBUG(object_library_[note].getTag() << ": score " << scores[note] << "\n");
+            continue;
+        }
+        candidates[note] = 0;
+        if (note < (int) note_metrics_.size()) {
+            note_metrics_[note].shortlist_rejections_->increment();
+        }
     }
+}
 
-    std::stringstream ss;
-    ss << total;
+// find all the instances of a note of the library in the scene
+void ObjectDetector::findObject(ImgObject& scene, KeypointMask& active_keypoints, int note, std::vector<cv::DMatch>& matches,
+                                std::vector<FoundObject>& objects_found, IterationWorkspace& workspace, bool wait) {
+    NoteImgObject& object = object_library_[note];
+    LOG_DEBUG(object.getTag() << "\n");
+    // iterate while the note is found in the scene image 
+    NoteMetrics* note_metrics = getNoteMetrics(object);
+    while(iterate(scene, active_keypoints, object, matches, objects_found, workspace, note_metrics, wait));
+}
+
+namespace {
+
+// Searches a range of notes of the library in a scene. Each note has its own workspace, with its own view
+// of the active scene keypoints and its own list of found objects, so the notes can be searched concurrently.
+class NoteSearch : public cv::ParallelLoopBody {
+private:
+    ObjectDetector& object_detector_;
+    ImgObject& scene_;
+    DetectionWorkspace& workspace_;
+public:
+    NoteSearch(ObjectDetector& object_detector, ImgObject& scene, DetectionWorkspace& workspace) :
+        object_detector_(object_detector), scene_(scene), workspace_(workspace) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int i = range.start; i < range.end; ++i) {
+            IterationWorkspace& note_workspace = workspace_.notes_[i];
+            note_workspace.recycle(note_workspace.objects_found_);
+            if (!workspace_.candidates_[i]) {
+                continue;
+            }
+            note_workspace.active_keypoints_.reset(scene_.getKeypoints().size());
+            object_detector_.findObject(scene_, note_workspace.active_keypoints_, i, workspace_.library_matches_[i],
+                                        note_workspace.objects_found_, note_workspace, false);
+        }
+    }
+};
 
-    Log::instance().debug("Total amount: " + ss.str() + "\n");
+}
+
+// find all the notes of the library in the scene
+std::vector<FoundObject> ObjectDetector::findAllObjects(ImgObject& scene, bool wait) {
+    DetectionWorkspace workspace;
+    return findAllObjects(scene, workspace, wait);
+}
+
+// find all the notes of the library in the scene, using the buffers of workspace. The notes found are kept
+// in the workspace, so they are only valid until it is used for the next scene.
+std::vector<FoundObject>& ObjectDetector::findAllObjects(ImgObject& scene, DetectionWorkspace& workspace, bool wait) {
+    if (scenes_ != NULL) {
+        scenes_->increment();
+    }
+    if (!scene.getProposals().empty()) {
+        searchRegions(scene, workspace, wait);
+    } else {
+        searchScene(scene, workspace, wait);
+    }
+    std::vector<FoundObject>& objects_found = workspace.objects_found_;
 
-    // write the total value of the notes in the image
-    int baseline = 0;
-    cv::Size text_size = cv::getTextSize(ss.str(), FONT_FACE, 1, FONT_THICKNESS, &baseline);
-    cv::putText(img_to_show, ss.str(), cv::Point(5, text_size.height + 5), FONT_FACE, 1, cv::Scalar(255,0,0), FONT_THICKNESS);
+    int total = 0;
+    for(unsigned int i = 0; i < objects_found.size(); ++i) {
+        total += objects_found[i].value_;
+    }
+    LOG_INFO("Total amount: " << total << "\n");
 
+    // the results are only drawn here when they are shown; otherwise drawing is up to the ResultSink of the caller
     if (wait) {
+        cv::Mat img_to_show;
+        {
+            ScopedStageTimer timer(stage_times_, STAGE_DRAWING, stage_histograms_[STAGE_DRAWING]);
+            img_to_show = RenderSink::render(scene.getFullImg(), objects_found);
+        }
         cv::destroyWindow(used_algorithms_ + " - Iteration");
         cv::imshow(used_algorithms_ + " - Result", img_to_show);
         cv::waitKey(0);
         cv::destroyWindow(used_algorithms_ + " - Result");
     }
-    objects_found_.clear();
+    return objects_found;
+}
+
+// Searches all the notes of the library in a scene whose features are computed. The notes found are
+// kept in the objects_found_ of workspace.
+void ObjectDetector::searchScene(ImgObject& scene, DetectionWorkspace& workspace, bool wait) {
+    if (workspace.notes_.size() < object_library_.size() + 1) {
+        workspace.notes_.resize(object_library_.size() + 1);
+    }
+    // the last workspace keeps the buffers of the notes found in the previous scene
+    IterationWorkspace& scene_workspace = workspace.notes_.back();
+    std::vector<FoundObject>& objects_found = workspace.objects_found_;
+    scene_workspace.recycle(objects_found);
+    if (!selectCandidates(scene, workspace)) {
+        return;
+    }
+    matchLibrary(scene, workspace);
+
+    if (parallel_search_ && !wait) {
+        // the notes found are merged in the library order, so the result is the same as the sequential search
+        cv::parallel_for_(cv::Range(0, (int) object_library_.size()), NoteSearch(*this, scene, workspace));
+        for (unsigned int i = 0; i < object_library_.size(); ++i) {
+            std::vector<FoundObject>& note_objects_found = workspace.notes_[i].objects_found_;
+            for (unsigned int j = 0; j < note_objects_found.size(); ++j) {
+                scene_workspace.addFoundObject(objects_found).swap(note_objects_found[j]);
+            }
+        }
+    } else {
+        // for each note in the library
+        for(unsigned int i = 0; i < object_library_.size(); ++i) {
+            if (!workspace.candidates_[i]) {
+                continue;
+            }
+            findObject(scene, scene.getActiveKeypoints(), i, workspace.library_matches_[i], objects_found, scene_workspace, wait);
+            // when all notes of the same type are found, reactivate the keypoints
+            scene.resetKeypoints();
+        }
+    }
+
+    // the notes were found in a reduced scene, so their contours are moved to the full scene
+    if (scene.getScale() != 1) {
+        for (unsigned int i = 0; i < objects_found.size(); ++i) {
+            refineObject(scene, objects_found[i], workspace);
+        }
+    }
+}
+
+namespace {
+
+// Searches the notes in a range of the regions proposed for a scene, each one with its own workspace
+class RegionSearch : public cv::ParallelLoopBody {
+private:
+    ObjectDetector& object_detector_;
+    ImgObject& scene_;
+    DetectionWorkspace& workspace_;
+public:
+    RegionSearch(ObjectDetector& object_detector, ImgObject& scene, DetectionWorkspace& workspace) :
+        object_detector_(object_detector), scene_(scene), workspace_(workspace) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int i = range.start; i < range.end; ++i) {
+            object_detector_.searchRegion(scene_, i, workspace_.region_scenes_[i], workspace_.regions_[i], false);
+        }
+    }
+};
+
+}
+
+// Searches the notes in each region proposed for the scene as an independent scene. The regions don't overlap,
+// so they are searched concurrently unless the iterations are shown. The notes found are merged in the
+// order of the regions in the objects_found_ of workspace.
+void ObjectDetector::searchRegions(ImgObject& scene, DetectionWorkspace& workspace, bool wait) {
+    if (workspace.notes_.size() < object_library_.size() + 1) {
+        workspace.notes_.resize(object_library_.size() + 1);
+    }
+    IterationWorkspace& scene_workspace = workspace.notes_.back();
+    std::vector<FoundObject>& objects_found = workspace.objects_found_;
+    scene_workspace.recycle(objects_found);
+
+    int n_regions = (int) scene.getProposals().size();
+    if ((int) workspace.regions_.size() < n_regions) {
+        workspace.regions_.resize(n_regions);
+        workspace.region_scenes_.resize(n_regions);
+    }
+    if (wait) {
+        for (int i = 0; i < n_regions; ++i) {
+            searchRegion(scene, i, workspace.region_scenes_[i], workspace.regions_[i], wait);
+        }
+    } else {
+        cv::parallel_for_(cv::Range(0, n_regions), RegionSearch(*this, scene, workspace));
+    }
+
+    for (int i = 0; i < n_regions; ++i) {
+        std::vector<FoundObject>& region_objects_found = workspace.regions_[i].objects_found_;
+        for (unsigned int j = 0; j < region_objects_found.size(); ++j) {
+            scene_workspace.addFoundObject(objects_found).swap(region_objects_found[j]);
+        }
+    }
+}
+
+// Computes the features of a proposed region of the scene, kept in region_scene, and searches the notes in it.
+// The contours of the notes found are moved to scene coordinates.
+void ObjectDetector::searchRegion(ImgObject& scene, int region, ImgObject& region_scene, DetectionWorkspace& workspace, bool wait) {
+    cv::Mat& full_img = scene.getFullImg();
+    cv::Rect rect = scene.getProposals()[region];
+    region_scene.setImage(full_img(rect));
+    cv::Mat& color = scene.getColor();
+    if (!color.empty()) {
+        // the same region in the low resolution color copy
+        double color_scale = (double) color.cols / full_img.cols;
+        cv::Rect color_rect(cvFloor(rect.x * color_scale), cvFloor(rect.y * color_scale),
+                            cvCeil(rect.width * color_scale), cvCeil(rect.height * color_scale));
+        color_rect &= cv::Rect(0, 0, color.cols, color.rows);
+        if (color_rect.area() > 0) {
+            region_scene.setColor(color(color_rect));
+        }
+    }
+
+    // the region is reduced by the same factor as the whole scene would be
+    int largest = std::max(full_img.rows, full_img.cols);
+    int max_dimension = 0;
+    if (max_dimension_ > 0 && largest > max_dimension_) {
+        max_dimension = std::max(1, cvRound((double) std::max(rect.width, rect.height) * max_dimension_ / largest));
+    }
+    region_scene.setMaxDimension(max_dimension);
+    computeFeatures(region_scene, true, false);
+    LOG_DEBUG("region " << region << ": " << region_scene.getKeypoints().size() << "\n\n");
+
+    searchScene(region_scene, workspace, wait);
+
+    cv::Point2f offset((float) rect.x, (float) rect.y);
+    std::vector<FoundObject>& objects_found = workspace.objects_found_;
+    for (unsigned int i = 0; i < objects_found.size(); ++i) {
+        for (unsigned int j = 0; j < objects_found[i].countour_.size(); ++j) {
+            objects_found[i].countour_[j] += offset;
+        }
+        for (unsigned int j = 0; j < objects_found[i].inliers_.size(); ++j) {
+            objects_found[i].inliers_[j] += offset;
+        }
+    }
 }
 
-// draw the contours in an image with the given text in the middle
-void ObjectDetector::drawCountourWithText(cv::Mat& img, std::vector<cv::Point2f>& countour, std::string text) {
-    line(img, countour[0], countour[1], cv::Scalar(0, 255, 0), 4);
-    line(img, countour[1], countour[2], cv::Scalar(0, 255, 0), 4);
-    line(img, countour[2], countour[3], cv::Scalar(0, 255, 0), 4);
-    line(img, countour[3], countour[0], cv::Scalar(0, 255, 0), 4);
+// Converts the contour of a note found in the reduced scene to full scene coordinates and, if enabled,
+// searches the note again in that region of the full scene, with the refine_ buffers of workspace.
+// The coarse contour is kept if the note isn't found again.
+void ObjectDetector::refineObject(ImgObject& scene, FoundObject& found_object, DetectionWorkspace& workspace) {
+    for (unsigned int i = 0; i < found_object.countour_.size(); ++i) {
+        found_object.countour_[i] *= scene.getScale();
+    }
+    for (unsigned int i = 0; i < found_object.inliers_.size(); ++i) {
+        found_object.inliers_[i] *= scene.getScale();
+    }
+    if (refine_max_dimension_ <= 0) {
+        return;
+    }
 
-    cv::Rect bounding_rect = cv::boundingRect(countour);
-    cv::Point2f center(bounding_rect.x + bounding_rect.width / 2.0, bounding_rect.y + bounding_rect.height / 2.0);
-    double max_dimen = bounding_rect.width > bounding_rect.height ? bounding_rect.width : bounding_rect.height;
+    NoteImgObject* object = NULL;
+    for (unsigned int i = 0; i < object_library_.size() && object == NULL; ++i) {
+        if (object_library_[i].getTag() == found_object.tag_) {
+            object = &object_library_[i];
+        }
+    }
+
+    // region of the note with a margin of 10% on each side
+    cv::Mat& full_img = scene.getFullImg();
+    cv::Rect region = cv::boundingRect(found_object.countour_);
+    int margin_x = region.width / 10;
+    int margin_y = region.height / 10;
+    region = cv::Rect(region.x - margin_x, region.y - margin_y, region.width + 2 * margin_x, region.height + 2 * margin_y);
+    region &= cv::Rect(0, 0, full_img.cols, full_img.rows);
+    if (object == NULL || region.area() == 0) {
+        return;
+    }
 
-    double font_scale = 1;
-    int baseline = 0;
-    cv::Size text_size = cv::getTextSize(text, FONT_FACE, font_scale, FONT_THICKNESS, &baseline);
+    ImgObject& region_scene = workspace.refine_scene_;
+    region_scene.setImage(full_img(region));
+    region_scene.setMaxDimension(refine_max_dimension_);
+    {
+        AllocationExclusion exclusion;
+        region_scene.compute(feature_detector_, descriptor_extractor_);
+    }
+    if (region_scene.getDescriptors().rows == 0 || object->getDescriptors().rows == 0) {
+        return;
+    }
+
+    std::vector<cv::DMatch>& matches = workspace.refine_matches_;
+    if (hamming_matcher_ != NULL) {
+        hamming_matcher_->match(object->getDescriptors(), region_scene.getDescriptors(), matches, workspace.hamming_);
+    } else {
+        descriptor_matcher_->match(object->getDescriptors(), region_scene.getDescriptors(), matches);
+    }
+
+    LOG_DEBUG("Refining " << object->getTag() << "\n");
+    std::vector<FoundObject>& refined = workspace.refined_;
+    IterationWorkspace& refine_workspace = workspace.refine_workspace_;
+    refine_workspace.recycle(refined);
+    // the note was already counted when it was found in the reduced scene
+    if (!iterate(region_scene, region_scene.getActiveKeypoints(), *object, matches, refined, refine_workspace, NULL, false)) {
+        return;
+    }
 
-    font_scale = max_dimen / (text_size.width * FONT_RATIO);
-    text_size = cv::getTextSize(text, FONT_FACE, font_scale, FONT_THICKNESS, &baseline);
-    cv::Point2f text_position = center - cv::Point2f(text_size.width / 2.0, - text_size.height / 2.0);
-    cv::putText(img, text, text_position, FONT_FACE, font_scale, cv::Scalar(255,0,0), FONT_THICKNESS);
+    cv::Point2f offset((float) region.x, (float) region.y);
+    for (unsigned int i = 0; i < found_object.countour_.size(); ++i) {
+        found_object.countour_[i] = refined[0].countour_[i] * region_scene.getScale() + offset;
+    }
+    found_object.inliers_.assign(refined[0].inliers_.begin(), refined[0].inliers_.end());
+    for (unsigned int i = 0; i < found_object.inliers_.size(); ++i) {
+        found_object.inliers_[i] = found_object.inliers_[i] * region_scene.getScale() + offset;
+    }
 }
 
-// draw the countours of a found note with its value in the middle
-void ObjectDetector::drawFoundObject(cv::Mat& img, FoundObject found_object) {
-    std::stringstream ss;
-    ss << found_object.value_;
-    drawCountourWithText(img, found_object.countour_, ss.str());
+// Removes the matches whose scene keypoint is no longer active
+void ObjectDetector::removeInactiveMatches(KeypointMask& active_keypoints, std::vector<cv::DMatch>& matches) {
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < matches.size(); ++i) {
+        if (active_keypoints.isActive(matches[i].trainIdx)) {
+            matches[kept++] = matches[i];
+        }
+    }
+    matches.resize(kept);
 }
 
 // verify if all points are inside a given countour
-bool ObjectDetector::allPointsInsideCountour(std::vector<cv::Point2f> countour, std::vector<cv::Point2f> inliers) {
-    for (unsigned int i = 0; i < inliers.size(); ++i) {
-        if(cv::pointPolygonTest(countour, inliers[i], false) < 0) {
+bool ObjectDetector::allPointsInsideCountour(const std::vector<cv::Point2f>& countour, const std::vector<cv::Point2f>& inliers) {
+    QuadRegion region(countour);
+    unsigned int i = 0;
+    // four points at a time
+    for (; i + 4 <= inliers.size(); i += 4) {
+        float x[4] = {inliers[i].x, inliers[i + 1].x, inliers[i + 2].x, inliers[i + 3].x};
+        float y[4] = {inliers[i].y, inliers[i + 1].y, inliers[i + 2].y, inliers[i + 3].y};
+        if (region.containsMask(x, y) != 0xF) {
+            return false;
+        }
+    }
+    for (; i < inliers.size(); ++i) {
+        if (!region.contains(inliers[i].x, inliers[i].y)) {
             return false;
         }
     }
     return true;
 }
 
-// find all notes in the library with the given algorithms
+// computes the features of all notes in the library with the given algorithms
 void ObjectDetector::computeAll(std::string used_algorithms, cv::FeatureDetector* detector,
                                 cv::DescriptorExtractor* extractor, cv::DescriptorMatcher* matcher) {
     used_algorithms_ = used_algorithms;
     feature_detector_ = detector;
     descriptor_extractor_ = extractor;
     descriptor_matcher_ = matcher;
+    hamming_matcher_ = dynamic_cast<HammingMatcher*>(matcher);
+    detector_key_ = MemoryFeatureCache::algorithmKey(detector, tile_size_, tile_overlap_);
+    extractor_key_ = MemoryFeatureCache::algorithmKey(extractor, tile_size_, tile_overlap_);
+
+    LOG_DEBUG("Number of Keypoints\n");
+    for (unsigned i = 0; i < object_library_.size(); ++i) {
+        // the image is read the first time the note is used, and is kept for the other combinations
+        if (!object_library_[i].load()) {
+            object_library_[i].setFeatures(std::vector<cv::KeyPoint>(), cv::Mat());
+            continue;
+        }
+
+        // the features are only computed if they aren't in the cache yet
+        bool cached = feature_cache_.load(object_library_[i], feature_detector_, descriptor_extractor_);
+        if (!cached) {
+            computeFeatures(object_library_[i], false, true);
+            feature_cache_.store(object_library_[i], feature_detector_, descriptor_extractor_);
+        }
+
+        LOG_DEBUG(object_library_[i].getTag() << ": " << object_library_[i].getKeypoints().size() << (cached ? " (cached)" : "") << "\n");
+    }
 
-    Log::instance().debug("Number of Keypoints\n");
-    std::stringstream ss;
+    // all the library descriptors are added to the matcher, so each scene is matched only once against the whole library.
+    // index_notes_ keeps the note of each image in the matcher, since notes without descriptors are not added.
+    std::vector<cv::Mat> library_descriptors;
+    index_notes_.clear();
     for (unsigned i = 0; i < object_library_.size(); ++i) {
-        object_library_[i].compute(feature_detector_, descriptor_extractor_);
+        if (object_library_[i].getDescriptors().rows > 0) {
+            library_descriptors.push_back(object_library_[i].getDescriptors());
+            index_notes_.push_back(i);
+        }
+    }
+    descriptor_matcher_->clear();
+    if (!library_descriptors.empty()) {
+        descriptor_matcher_->add(library_descriptors);
+        descriptor_matcher_->train();
+    }
+
+    loadVocabulary();
+}
+
+// Reads the vocabulary of the current algorithms, if there is a vocabulary file, and indexes the library with it
+void ObjectDetector::loadVocabulary() {
+    vocabulary_index_.clear();
+    if (vocabulary_filename_.empty()) {
+        return;
+    }
+
+    cv::FileStorage fs(vocabulary_filename_, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        LOG_ERROR("Error reading " << vocabulary_filename_ << "\n");
+        return;
+    }
+    std::string name = VocabularyIndex::getNodeName(feature_detector_, descriptor_extractor_);
+    if (!vocabulary_index_.read(fs[name])) {
+        LOG_ERROR("No vocabulary " << name << " in " << vocabulary_filename_ << ", all the notes are searched\n");
+        return;
+    }
+
+    std::vector<cv::Mat> descriptors;
+    for (unsigned int i = 0; i < object_library_.size(); ++i) {
+        descriptors.push_back(object_library_[i].getDescriptors());
+    }
+    if (!vocabulary_index_.index(descriptors)) {
+        LOG_ERROR("The vocabulary " << name << " doesn't fit the descriptors, all the notes are searched\n");
+        vocabulary_index_.clear();
+    }
+}
 
-        ss << object_library_[i].getTag() << ": " << object_library_[i].getKeypoints().size() << "\n";
-        Log::instance().debug(ss.str());
-        ss.str("");
+// Detects the keypoints and extracts the descriptors of a scene with the current algorithms.
+// With region proposals, only the regions are found here; their features are computed when they are searched.
+void ObjectDetector::computeScene(ImgObject& scene) {
+    if (region_proposals_) {
+        bool proposed;
+        {
+            ScopedStageTimer timer(stage_times_, STAGE_PROPOSAL, stage_histograms_[STAGE_PROPOSAL]);
+            proposed = region_proposer_.propose(scene.getFullImg(), scene.getProposals());
+        }
+        if (proposed) {
+            LOG_DEBUG("scene: " << scene.getProposals().size() << " regions\n\n");
+            return;
+        }
     }
 
-    scene_.compute(feature_detector_, descriptor_extractor_);
-    ss << "scene: " << scene_.getKeypoints().size() << "\n\n";
-    Log::instance().debug(ss.str());
+    scene.setMaxDimension(max_dimension_);
+    computeFeatures(scene, true, reuse_scene_features_);
+
+    LOG_DEBUG("scene: " << scene.getKeypoints().size() << "\n\n");
+}
+
+// Detects the keypoints and extracts the descriptors of an image. A scene is processed by tiles if it is larger than
+// the tiles, and its time is added to the detection stages; a note is processed at once, as in the feature cache.
+// If reuse is true, the keypoints and descriptors already computed for the same image with the same detector
+// and extractor are taken from the memory cache.
+void ObjectDetector::computeFeatures(ImgObject& image, bool scene, bool reuse) {
+    // the allocations of the detectors and extractors of OpenCV are out of the control of the search
+    AllocationExclusion exclusion;
+    uint64 image_id = image.getImageId();
+    bool tiled = scene && tile_size_ > 0 && std::max(image.getImg().rows, image.getImg().cols) > tile_size_;
+    {
+        ScopedStageTimer timer(scene ? stage_times_ : NULL, STAGE_DETECT, scene ? stage_histograms_[STAGE_DETECT] : NULL);
+        if (reuse && memory_cache_.getDescriptors(detector_key_, image_id, extractor_key_, image.getKeypoints(), image.getDescriptors())) {
+            LOG_DEBUG("features reused: " << image.getKeypoints().size() << "\n");
+            // makes the keypoints active and indexes them, as computing the descriptors does
+            image.setFeatures(image.getKeypoints(), image.getDescriptors());
+            return;
+        }
+        if (reuse && memory_cache_.getKeypoints(detector_key_, image_id, image.getKeypoints())) {
+            LOG_DEBUG("keypoints reused: " << image.getKeypoints().size() << "\n");
+        } else {
+            if (tiled) {
+                image.detectKeypointsTiled(feature_detector_, tile_size_, tile_overlap_);
+            } else {
+                image.detectKeypoints(feature_detector_);
+            }
+            if (reuse) {
+                memory_cache_.putKeypoints(detector_key_, image_id, image.getKeypoints());
+            }
+        }
+    }
+    {
+        ScopedStageTimer timer(scene ? stage_times_ : NULL, STAGE_DESCRIBE, scene ? stage_histograms_[STAGE_DESCRIBE] : NULL);
+        if (tiled) {
+            image.computeDescriptorsTiled(descriptor_extractor_, tile_size_, tile_overlap_);
+        } else {
+            image.computeDescriptors(descriptor_extractor_);
+        }
+        if (reuse) {
+            memory_cache_.putDescriptors(detector_key_, image_id, extractor_key_, image.getKeypoints(), image.getDescriptors());
+        }
+    }
 }
\ No newline at end of file
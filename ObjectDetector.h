@@ -5,42 +5,169 @@
 #include "opencv2/features2d/features2d.hpp"
 
 #include "NoteImgObject.h"
+#include "HammingMatcher.h"
+#include "FeatureCache.h"
+#include "MemoryFeatureCache.h"
+#include "HomographyEstimator.h"
+#include "RegionProposer.h"
+#include "VocabularyIndex.h"
+#include "StageTimer.h"
+#include "Metrics.h"
 
 // Keeps the information about the founded note, such as the contours and value.
+// The inliers are the scene points that agreed with the homography of the note.
 struct FoundObject {
-    FoundObject(std::vector<cv::Point2f> countour, int value, std::string tag) : countour_(countour), value_(value), tag_(tag) {};
+    FoundObject(void) : value_(0) {};
+    FoundObject(const std::vector<cv::Point2f>& countour, int value, const std::string& tag,
+        const std::vector<cv::Point2f>& inliers = std::vector<cv::Point2f>()) : countour_(countour), value_(value), tag_(tag), inliers_(inliers) {};
+    void swap(FoundObject& other) {
+        countour_.swap(other.countour_);
+        std::swap(value_, other.value_);
+        tag_.swap(other.tag_);
+        inliers_.swap(other.inliers_);
+    };
     std::vector<cv::Point2f> countour_;
     int value_;
     std::string tag_;
+    std::vector<cv::Point2f> inliers_;
 };
 
-// Applies various algorithms to find notes in a given image
+// Buffers used by the iterations of the search of a note. The found objects that are no longer used are kept
+// in spare_objects_ with their buffers, so once all the buffers have grown the search doesn't allocate memory.
+struct IterationWorkspace {
+    std::vector<cv::DMatch> good_matches_;
+    std::vector<cv::Point2f> points_obj_;
+    std::vector<cv::Point2f> points_scene_;
+    std::vector<int> inliers_;
+    std::vector<cv::Point2f> inlier_points_;
+    std::vector<cv::Point2f> scene_corners_;
+    HomographyEstimator homography_estimator_;
+    KeypointMask active_keypoints_;
+    std::vector<FoundObject> objects_found_;
+    std::vector<FoundObject> spare_objects_;
+
+    FoundObject& addFoundObject(std::vector<FoundObject>& objects_found);
+    void recycle(std::vector<FoundObject>& objects_found);
+};
+
+// Buffers of the search of the notes in a scene, kept between scenes. Each thread searching scenes
+// must have its own workspace; notes_ has the buffers of each note for the parallel search.
+// candidates_ tells which notes of the library are searched in the current scene.
+// regions_ and region_scenes_ are the workspace and the image of each region proposed for the scene,
+// which only grow when a scene has more regions than any before. The refine_ buffers are used to search
+// again the notes found in a reduced scene.
+struct DetectionWorkspace {
+    HammingWorkspace hamming_;
+    std::vector<std::vector<cv::DMatch>> matches_;
+    std::vector<std::vector<cv::DMatch>> library_matches_;
+    std::vector<IterationWorkspace> notes_;
+    std::vector<FoundObject> objects_found_;
+    ColorSignature scene_signature_;
+    std::vector<char> candidates_;
+    std::vector<char> train_images_;
+    std::vector<int> words_;
+    std::vector<float> scores_;
+    std::vector<int> ranking_;
+    std::vector<DetectionWorkspace> regions_;
+    std::vector<ImgObject> region_scenes_;
+    ImgObject refine_scene_;
+    std::vector<cv::DMatch> refine_matches_;
+    std::vector<FoundObject> refined_;
+    IterationWorkspace refine_workspace_;
+};
+
+// Counters of the search of a note of the library with the current combination of algorithms
+struct NoteMetrics {
+    Counter* matches_;
+    Counter* good_matches_;
+    Counter* inliers_;
+    Counter* homography_failures_;
+    Counter* outside_contour_;
+    Counter* found_;
+    Counter* color_rejections_;
+    Counter* shortlist_rejections_;
+};
+
+// Applies various algorithms to find notes in a given image.
+// The scene images are kept by the caller, so the same library can be used for several scenes at once.
 class ObjectDetector {
 private:
     std::vector<NoteImgObject> object_library_;
-    NoteImgObject* object_;
-    ImgObject scene_;
 
     std::string used_algorithms_;
     cv::FeatureDetector* feature_detector_;
     cv::DescriptorExtractor* descriptor_extractor_;
     cv::DescriptorMatcher* descriptor_matcher_;
+    // the same matcher, if it is a HammingMatcher, whose searches can reuse the buffers of the workspaces
+    HammingMatcher* hamming_matcher_;
+    std::vector<int> index_notes_;
 
-    std::vector<FoundObject> objects_found_;
+    FeatureCache feature_cache_;
+    MemoryFeatureCache memory_cache_;
+    uint64 detector_key_;
+    uint64 extractor_key_;
+    bool reuse_scene_features_;
+    bool parallel_search_;
+    int max_dimension_;
+    int refine_max_dimension_;
+    bool region_proposals_;
+    RegionProposer region_proposer_;
+    bool color_filter_;
+    int tile_size_;
+    int tile_overlap_;
+    std::string vocabulary_filename_;
+    int shortlist_size_;
+    VocabularyIndex vocabulary_index_;
+    StageTimes* stage_times_;
+
+    std::string combination_name_;
+    std::vector<NoteMetrics> note_metrics_;
+    Histogram* stage_histograms_[STAGE_COUNT];
+    Counter* scenes_;
+
+    void updateMetrics();
+    NoteMetrics* getNoteMetrics(NoteImgObject& object);
+    void computeFeatures(ImgObject& image, bool scene, bool reuse);
+    void loadVocabulary();
+    void shortlist(ImgObject& scene, DetectionWorkspace& workspace);
 public:
     ObjectDetector(void);
-    ObjectDetector(std::string scene_filename, cv::FeatureDetector* feature_detector, 
-        cv::DescriptorExtractor* descriptor_extractor,
+    ObjectDetector(cv::FeatureDetector* feature_detector, cv::DescriptorExtractor* descriptor_extractor,
         cv::DescriptorMatcher* descriptor_matcher);
     ~ObjectDetector(void);
 
-    void loadLibrary(bool with_patches);
+    void setCacheDirectory(std::string directory);
+    void setParallelSearch(bool parallel_search);
+    void setPyramid(int max_dimension, int refine_max_dimension);
+    void setRegionProposals(bool region_proposals);
+    void setColorFilter(bool color_filter);
+    bool hasColorFilter();
+    bool hasReusableMatcher();
+    void setTiling(int tile_size, int overlap = 64);
+    void setReuseSceneFeatures(bool reuse_scene_features);
+    void setVocabulary(std::string filename, int shortlist_size);
+    bool trainVocabulary(cv::FileStorage& fs, int words);
+    void setStageTimes(StageTimes* stage_times);
+    void setCombinationName(std::string combination_name);
+    bool loadLibrary(std::string manifest, bool with_patches);
+    const MemoryFeatureCache& getMemoryCache();
+    std::vector<std::string> getLibraryFilenames();
     void computeAll(std::string used_algorithms, cv::FeatureDetector* detector, cv::DescriptorExtractor* extractor, cv::DescriptorMatcher* matcher);
-    bool iterate(bool wait);
-    void findAllObjects(bool wait);
-    bool allPointsInsideCountour(std::vector<cv::Point2f> countour, std::vector<cv::Point2f> inliers);
-    void drawCountourWithText(cv::Mat& img, std::vector<cv::Point2f>& countour, std::string text);
-    void drawFoundObject(cv::Mat& img, FoundObject found_object);
+    void computeScene(ImgObject& scene);
+    bool selectCandidates(ImgObject& scene, DetectionWorkspace& workspace);
+    void matchLibrary(ImgObject& scene, DetectionWorkspace& workspace);
+    bool iterate(ImgObject& scene, KeypointMask& active_keypoints, NoteImgObject& object, std::vector<cv::DMatch>& matches,
+        std::vector<FoundObject>& objects_found, IterationWorkspace& workspace, NoteMetrics* note_metrics, bool wait);
+    void findObject(ImgObject& scene, KeypointMask& active_keypoints, int note, std::vector<cv::DMatch>& matches,
+        std::vector<FoundObject>& objects_found, IterationWorkspace& workspace, bool wait);
+    std::vector<FoundObject> findAllObjects(ImgObject& scene, bool wait);
+    std::vector<FoundObject>& findAllObjects(ImgObject& scene, DetectionWorkspace& workspace, bool wait);
+    void searchScene(ImgObject& scene, DetectionWorkspace& workspace, bool wait);
+    void searchRegions(ImgObject& scene, DetectionWorkspace& workspace, bool wait);
+    void searchRegion(ImgObject& scene, int region, ImgObject& region_scene, DetectionWorkspace& workspace, bool wait);
+    void refineObject(ImgObject& scene, FoundObject& found_object, DetectionWorkspace& workspace);
+    void removeInactiveMatches(KeypointMask& active_keypoints, std::vector<cv::DMatch>& matches);
+    bool allPointsInsideCountour(const std::vector<cv::Point2f>& countour, const std::vector<cv::Point2f>& inliers);
 };
 
 #endif
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "RegionProposer.h"
+
+// Thresholds of the Canny edge detector in the reduced scene
+#define CANNY_LOW 30
+#define CANNY_HIGH 90
+// Contours whose area is below this fraction of their minimum area rectangle are not note shaped
+#define MIN_RECTANGULARITY 0.6
+// Largest ratio between the sides of a proposal; the notes are about 2:1
+#define MAX_ASPECT_RATIO 5
+// Margin added to each side of a proposal, as a fraction of its size
+#define REGION_MARGIN 0.1
+
+RegionProposer::RegionProposer(int max_dimension, double min_area_ratio, double max_area_ratio) {
+    max_dimension_ = max_dimension;
+    min_area_ratio_ = min_area_ratio;
+    max_area_ratio_ = max_area_ratio;
+}
+
+RegionProposer::~RegionProposer(void) {}
+
+// Proposes the regions of img, in its coordinates, that may have notes. Returns false if no region was found,
+// or if the regions cover so much of the scene that it is better to search all of it.
+bool RegionProposer::propose(const cv::Mat& img, std::vector<cv::Rect>& regions) const {
+    regions.clear();
+    if (img.empty()) {
+        return false;
+    }
+
+    double scale = 1;
+    int largest = std::max(img.rows, img.cols);
+    cv::Mat small;
+    if (max_dimension_ > 0 && largest > max_dimension_) {
+        scale = (double) largest / max_dimension_;
+        cv::resize(img, small, cv::Size(cvRound(img.cols / scale), cvRound(img.rows / scale)), 0, 0, cv::INTER_AREA);
+    } else {
+        small = img;
+    }
+
+    // the edges are dilated to close the gaps in the borders of the notes
+    cv::Mat edges;
+    cv::GaussianBlur(small, edges, cv::Size(5, 5), 0);
+    cv::Canny(edges, edges, CANNY_LOW, CANNY_HIGH);
+    cv::dilate(edges, edges, cv::Mat(), cv::Point(-1, -1), 2);
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(edges, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+
+    double image_area = (double) small.rows * small.cols;
+    cv::Rect bounds(0, 0, img.cols, img.rows);
+    std::vector<cv::Point> polygon;
+    for (unsigned int i = 0; i < contours.size(); ++i) {
+        double area = cv::contourArea(contours[i]);
+        if (area < min_area_ratio_ * image_area) {
+            continue;
+        }
+
+        // a contour is kept if it can be simplified to a convex quadrilateral or fills most of its rectangle
+        cv::approxPolyDP(contours[i], polygon, 0.04 * cv::arcLength(contours[i], true), true);
+        bool quadrilateral = polygon.size() == 4 && cv::isContourConvex(polygon);
+        cv::RotatedRect rect = cv::minAreaRect(contours[i]);
+        double short_side = std::min(rect.size.width, rect.size.height);
+        double long_side = std::max(rect.size.width, rect.size.height);
+        if (short_side <= 0 || long_side / short_side > MAX_ASPECT_RATIO) {
+            continue;
+        }
+        if (!quadrilateral && area < MIN_RECTANGULARITY * rect.size.area()) {
+            continue;
+        }
+
+        // bounding box in the coordinates of the scene, with a margin
+        cv::Rect box = cv::boundingRect(contours[i]);
+        int margin_x = cvRound(box.width * REGION_MARGIN);
+        int margin_y = cvRound(box.height * REGION_MARGIN);
+        cv::Rect region(cvFloor((box.x - margin_x) * scale), cvFloor((box.y - margin_y) * scale),
+                        cvCeil((box.width + 2 * margin_x) * scale), cvCeil((box.height + 2 * margin_y) * scale));
+        region &= bounds;
+        if (region.area() > 0) {
+            regions.push_back(region);
+        }
+    }
+
+    // overlapping regions are merged until none overlap
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (unsigned int i = 0; i < regions.size() && !merged; ++i) {
+            for (unsigned int j = i + 1; j < regions.size() && !merged; ++j) {
+                if ((regions[i] & regions[j]).area() > 0) {
+                    regions[i] |= regions[j];
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    double covered = 0;
+    for (unsigned int i = 0; i < regions.size(); ++i) {
+        covered += regions[i].area();
+    }
+    if (regions.empty() || covered > max_area_ratio_ * bounds.area()) {
+        regions.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef REGION_PROPOSER_H
+#define REGION_PROPOSER_H
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+// Finds the regions of a scene that may have notes before any keypoint is detected. The edges of a reduced copy
+// of the scene are closed into contours, and the contours shaped like a quadrilateral are proposed.
+// Overlapping proposals are merged, so a note is never split between two regions.
+class RegionProposer {
+private:
+    int max_dimension_;
+    double min_area_ratio_;
+    double max_area_ratio_;
+public:
+    RegionProposer(int max_dimension = 512, double min_area_ratio = 0.005, double max_area_ratio = 0.8);
+    ~RegionProposer(void);
+
+    bool propose(const cv::Mat& img, std::vector<cv::Rect>& regions) const;
+};
+
+#endif
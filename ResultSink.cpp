@@ -0,0 +1,180 @@
+#include <cctype>
+#include <sstream>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "ResultSink.h"
+#include "BatchDetector.h"
+
+#include "Log.h"
+
+#define FONT_FACE cv::FONT_HERSHEY_SCRIPT_COMPLEX
+#define FONT_THICKNESS 3
+#define FONT_RATIO 4
+
+namespace {
+
+// draw the contours in an image with the given text in the middle
+void drawCountourWithText(cv::Mat& img, const std::vector<cv::Point2f>& countour, std::string text) {
+    line(img, countour[0], countour[1], cv::Scalar(0, 255, 0), 4);
+    line(img, countour[1], countour[2], cv::Scalar(0, 255, 0), 4);
+    line(img, countour[2], countour[3], cv::Scalar(0, 255, 0), 4);
+    line(img, countour[3], countour[0], cv::Scalar(0, 255, 0), 4);
+
+    cv::Rect bounding_rect = cv::boundingRect(countour);
+    cv::Point2f center(bounding_rect.x + bounding_rect.width / 2.0, bounding_rect.y + bounding_rect.height / 2.0);
+    double max_dimen = bounding_rect.width > bounding_rect.height ? bounding_rect.width : bounding_rect.height;
+
+    double font_scale = 1;
+    int baseline = 0;
+    cv::Size text_size = cv::getTextSize(text, FONT_FACE, font_scale, FONT_THICKNESS, &baseline);
+
+    font_scale = max_dimen / (text_size.width * FONT_RATIO);
+    text_size = cv::getTextSize(text, FONT_FACE, font_scale, FONT_THICKNESS, &baseline);
+    cv::Point2f text_position = center - cv::Point2f(text_size.width / 2.0, - text_size.height / 2.0);
+    cv::putText(img, text, text_position, FONT_FACE, font_scale, cv::Scalar(255,0,0), FONT_THICKNESS);
+}
+
+// draw the countours of a found note with its value in the middle
+void drawFoundObject(cv::Mat& img, const FoundObject& found_object) {
+    std::stringstream ss;
+    ss << found_object.value_;
+    drawCountourWithText(img, found_object.countour_, ss.str());
+}
+
+}
+
+ResultSink::~ResultSink(void) {}
+
+// Waits until all the results given are written
+void ResultSink::close() {}
+
+NullSink::NullSink(void) {}
+
+NullSink::~NullSink(void) {}
+
+void NullSink::write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found) {}
+
+void NullSink::writeError(std::string scene_name, std::string message) {}
+
+JsonSink::JsonSink(std::ostream& output) : output_(output) {}
+
+JsonSink::~JsonSink(void) {}
+
+void JsonSink::write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found) {
+    std::string line = BatchDetector::toJson(scene_name, objects_found);
+    std::lock_guard<std::mutex> lock(mutex_);
+    output_ << line << std::endl;
+}
+
+void JsonSink::writeError(std::string scene_name, std::string message) {
+    std::string line = BatchDetector::toErrorJson(scene_name, message);
+    std::lock_guard<std::mutex> lock(mutex_);
+    output_ << line << std::endl;
+}
+
+RenderSink::RenderSink(std::string directory, int max_queue) : running_(true) {
+    directory_ = directory;
+    if (!directory_.empty() && directory_[directory_.size() - 1] != '/' && directory_[directory_.size() - 1] != '\\') {
+        directory_ += "/";
+    }
+    max_queue_ = max_queue > 0 ? max_queue : 1;
+    thread_ = std::thread(&RenderSink::renderLoop, this);
+}
+
+RenderSink::~RenderSink(void) {
+    close();
+}
+
+// The image is copied, since the caller may reuse its buffer for the next scene
+void RenderSink::write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_ && (int) queue_.size() >= max_queue_) {
+        queue_changed_.wait(lock);
+    }
+    if (!running_) {
+        return;
+    }
+    queue_.push_back(RenderJob(scene_name, img.clone(), objects_found));
+    queue_changed_.notify_all();
+}
+
+void RenderSink::writeError(std::string scene_name, std::string message) {
+    LOG_ERROR("Unable to process " << scene_name << ": " << message << "\n");
+}
+
+// Draws the scenes left in the queue and stops the background thread
+void RenderSink::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        queue_changed_.notify_all();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void RenderSink::renderLoop() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_ && queue_.empty()) {
+            queue_changed_.wait(lock);
+        }
+        if (queue_.empty()) {
+            return;
+        }
+        RenderJob job = queue_.front();
+        queue_.pop_front();
+        queue_changed_.notify_all();
+        lock.unlock();
+
+        std::string filename = getFilename(job.scene_name_);
+        if (!cv::imwrite(filename, render(job.img_, job.objects_found_))) {
+            LOG_ERROR("Unable to write " << filename << "\n");
+        }
+    }
+}
+
+// Name of the image of a scene in the output directory: the scene filename, without its directory
+// and extension, with the characters that can't appear in a filename replaced
+std::string RenderSink::getFilename(std::string scene_name) {
+    std::string name = scene_name.substr(scene_name.find_last_of("/\\") + 1);
+    size_t extension = name.find_last_of('.');
+    if (extension != std::string::npos && extension > 0 && name.find('#', extension) == std::string::npos) {
+        name = name.substr(0, extension);
+    }
+    for (unsigned int i = 0; i < name.size(); ++i) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_' && name[i] != '.') {
+            name[i] = '_';
+        }
+    }
+    return directory_ + name + "_result.jpg";
+}
+
+// Draws the notes found, with their values, and the total amount on a color copy of the scene
+cv::Mat RenderSink::render(const cv::Mat& img, const std::vector<FoundObject>& objects_found) {
+    cv::Mat img_to_show;
+    if (img.channels() == 1) {
+        cv::cvtColor(img, img_to_show, CV_GRAY2RGB);
+    } else {
+        img_to_show = img.clone();
+    }
+
+    int total = 0;
+    // draw the found notes in the scene image
+    for (unsigned int i = 0; i < objects_found.size(); ++i) {
+        drawFoundObject(img_to_show, objects_found[i]);
+        total += objects_found[i].value_;
+    }
+
+    std::stringstream ss;
+    ss << total;
+
+    // write the total value of the notes in the image
+    int baseline = 0;
+    cv::Size text_size = cv::getTextSize(ss.str(), FONT_FACE, 1, FONT_THICKNESS, &baseline);
+    cv::putText(img_to_show, ss.str(), cv::Point(5, text_size.height + 5), FONT_FACE, 1, cv::Scalar(255,0,0), FONT_THICKNESS);
+    return img_to_show;
+}
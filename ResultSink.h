@@ -0,0 +1,86 @@
+#ifndef RESULT_SINK_H
+#define RESULT_SINK_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "ObjectDetector.h"
+
+// Receives the notes found in each scene. The detection only produces the contours, values and tags of the notes;
+// what is done with them is up to the sink, so nothing is drawn when nobody looks at the results.
+// write and writeError can be called from several threads at once.
+class ResultSink {
+public:
+    virtual ~ResultSink(void);
+
+    virtual void write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found) = 0;
+    virtual void writeError(std::string scene_name, std::string message) = 0;
+    virtual void close();
+};
+
+// Discards the results
+class NullSink : public ResultSink {
+public:
+    NullSink(void);
+    virtual ~NullSink(void);
+
+    virtual void write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found);
+    virtual void writeError(std::string scene_name, std::string message);
+};
+
+// Writes one JSON line per scene
+class JsonSink : public ResultSink {
+private:
+    std::ostream& output_;
+    std::mutex mutex_;
+public:
+    JsonSink(std::ostream& output);
+    virtual ~JsonSink(void);
+
+    virtual void write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found);
+    virtual void writeError(std::string scene_name, std::string message);
+};
+
+// A scene waiting to be drawn
+struct RenderJob {
+    RenderJob(std::string scene_name, cv::Mat img, std::vector<FoundObject> objects_found) :
+        scene_name_(scene_name), img_(img), objects_found_(objects_found) {};
+    std::string scene_name_;
+    cv::Mat img_;
+    std::vector<FoundObject> objects_found_;
+};
+
+// Draws the notes found on each scene and saves the image in a directory. The drawing is done by a
+// background thread; write only blocks when max_queue scenes are already waiting to be drawn.
+class RenderSink : public ResultSink {
+private:
+    std::string directory_;
+    int max_queue_;
+
+    std::deque<RenderJob> queue_;
+    std::mutex mutex_;
+    std::condition_variable queue_changed_;
+    std::thread thread_;
+    bool running_;
+
+    void renderLoop();
+    std::string getFilename(std::string scene_name);
+public:
+    RenderSink(std::string directory, int max_queue = 16);
+    virtual ~RenderSink(void);
+
+    virtual void write(std::string scene_name, const cv::Mat& img, const std::vector<FoundObject>& objects_found);
+    virtual void writeError(std::string scene_name, std::string message);
+    virtual void close();
+
+    static cv::Mat render(const cv::Mat& img, const std::vector<FoundObject>& objects_found);
+};
+
+#endif
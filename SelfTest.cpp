@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/features2d/features2d.hpp"
+
+#include "SelfTest.h"
+#include "FeatureTiling.h"
+#include "HammingMatcher.h"
+#include "KeypointGrid.h"
+#include "HomographyEstimator.h"
+#include "FeatureCache.h"
+#include "NoteImgObject.h"
+#include "ResultSink.h"
+#include "ImgObject.h"
+#include "Benchmark.h"
+
+// Fraction of the keypoints that must be found in both the whole image and the tiles
+#define MIN_TILING_AGREEMENT 0.99
+// Pixels between the same keypoint found in the whole image and in the tiles
+#define TILING_TOLERANCE 1.0f
+// Bytes of the random binary descriptors, as ORB and BRIEF
+#define DESCRIPTOR_BYTES 32
+// Pixels from the edges of a contour where the tests of the points may round differently
+#define CONTOUR_TOLERANCE 0.01
+// Reprojection threshold of both homography estimations, and largest error of the corners of a note
+#define HOMOGRAPHY_THRESHOLD 3.0
+// Fraction of the inliers of findHomography that HomographyEstimator must find at least
+#define MIN_INLIER_RATIO 0.95
+// Note image written for the feature cache check, in the working directory with its cache files
+#define CACHE_NOTE_FILENAME "selftest_note.png"
+
+namespace {
+// Number of keypoints with one of the others within TILING_TOLERANCE pixels and in the same octave.
+// With descriptors, only the keypoints whose descriptor is also the same as the one of the other are counted.
+int countFound(const std::vector<cv::KeyPoint>& keypoints, const cv::Mat& descriptors,
+               const std::vector<cv::KeyPoint>& others, const cv::Mat& other_descriptors, cv::Size size) {
+    // the others by row, so each keypoint is only compared with those in the rows around it
+    std::vector<std::vector<int>> rows(size.height + 1);
+    for (unsigned int i = 0; i < others.size(); ++i) {
+        int row = std::min(std::max(cvRound(others[i].pt.y), 0), size.height);
+        rows[row].push_back(i);
+    }
+
+    int found = 0;
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        const cv::KeyPoint& a = keypoints[i];
+        int center = std::min(std::max(cvRound(a.pt.y), 0), size.height);
+        bool same = false;
+        for (int row = std::max(center - 1, 0); row <= std::min(center + 1, size.height) && !same; ++row) {
+            for (unsigned int j = 0; j < rows[row].size() && !same; ++j) {
+                const cv::KeyPoint& b = others[rows[row][j]];
+                cv::Point2f distance = a.pt - b.pt;
+                if (a.octave != b.octave || distance.dot(distance) > TILING_TOLERANCE * TILING_TOLERANCE) {
+                    continue;
+                }
+                same = descriptors.empty() ||
+                    cv::norm(descriptors.row(i), other_descriptors.row(rows[row][j]), cv::NORM_INF) == 0;
+            }
+        }
+        if (same) {
+            ++found;
+        }
+    }
+    return found;
+}
+
+// Random binary descriptors. If near is given, every other descriptor is one of near with a few bits flipped,
+// so it has a clear nearest neighbour there.
+cv::Mat createDescriptors(cv::RNG& rng, int rows, const std::vector<cv::Mat>& near) {
+    cv::Mat descriptors(rows, DESCRIPTOR_BYTES, CV_8U);
+    rng.fill(descriptors, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    for (int r = 0; r < rows && !near.empty(); r += 2) {
+        const cv::Mat& image = near[rng.uniform(0, (int) near.size())];
+        image.row(rng.uniform(0, image.rows)).copyTo(descriptors.row(r));
+        for (int flips = rng.uniform(0, 20); flips > 0; --flips) {
+            descriptors.at<uchar>(r, rng.uniform(0, DESCRIPTOR_BYTES)) ^= (uchar) (1 << rng.uniform(0, 8));
+        }
+    }
+    return descriptors;
+}
+
+// True if the features of both images are the same, field by field
+bool sameFeatures(ImgObject& a, ImgObject& b) {
+    std::vector<cv::KeyPoint>& a_keypoints = a.getKeypoints();
+    std::vector<cv::KeyPoint>& b_keypoints = b.getKeypoints();
+    if (a_keypoints.size() != b_keypoints.size() || a.getDescriptors().size() != b.getDescriptors().size() ||
+        a.getDescriptors().type() != b.getDescriptors().type()) {
+        return false;
+    }
+    for (unsigned int i = 0; i < a_keypoints.size(); ++i) {
+        if (a_keypoints[i].pt != b_keypoints[i].pt || a_keypoints[i].size != b_keypoints[i].size ||
+            a_keypoints[i].angle != b_keypoints[i].angle || a_keypoints[i].response != b_keypoints[i].response ||
+            a_keypoints[i].octave != b_keypoints[i].octave || a_keypoints[i].class_id != b_keypoints[i].class_id) {
+            return false;
+        }
+    }
+    return a.getDescriptors().empty() || cv::norm(a.getDescriptors(), b.getDescriptors(), cv::NORM_INF) == 0;
+}
+
+// Largest distance between the corners of a note mapped by a homography and by the true one
+double cornerError(const cv::Mat& homography, const cv::Mat& true_homography, cv::Size note) {
+    std::vector<cv::Point2f> corners, mapped, expected;
+    corners.push_back(cv::Point2f(0, 0));
+    corners.push_back(cv::Point2f((float) note.width, 0));
+    corners.push_back(cv::Point2f((float) note.width, (float) note.height));
+    corners.push_back(cv::Point2f(0, (float) note.height));
+    cv::perspectiveTransform(corners, mapped, homography);
+    cv::perspectiveTransform(corners, expected, true_homography);
+    double error = 0;
+    for (unsigned int i = 0; i < corners.size(); ++i) {
+        error = std::max(error, (double) cv::norm(mapped[i] - expected[i]));
+    }
+    return error;
+}
+}
+
+SelfTest::SelfTest(std::ostream& output) : output_(output), failures_(0) {}
+
+SelfTest::~SelfTest(void) {}
+
+bool SelfTest::report(std::string name, bool passed, std::string details) {
+    output_ << (passed ? "PASS " : "FAIL ") << name << ": " << details << "\n";
+    if (!passed) {
+        ++failures_;
+    }
+    return passed;
+}
+
+// Blurred noise crossed by a few lines, so it has corners everywhere and at several scales
+cv::Mat SelfTest::createTexture(cv::Size size, int seed) {
+    cv::RNG rng(seed);
+    cv::Mat img(size, CV_8UC1);
+    rng.fill(img, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::GaussianBlur(img, img, cv::Size(0, 0), 1.5);
+    for (int i = 0; i < 40; ++i) {
+        cv::Point start(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::Point end(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::line(img, start, end, cv::Scalar(rng.uniform(0, 256)), rng.uniform(1, 6));
+    }
+    return img;
+}
+
+// The keypoints and descriptors of an image detected and described in tiles must be the ones of the whole image,
+// except for a few keypoints near the borders of the tiles
+bool SelfTest::checkTiling() {
+    cv::Mat img = createTexture(cv::Size(1200, 900), 1);
+    FeatureTiling tiling(img.size(), 256, 64);
+    cv::FastFeatureDetector detector(20);
+    cv::BriefDescriptorExtractor brief_extractor;
+    cv::OrbDescriptorExtractor orb_extractor;
+    cv::DescriptorExtractor* extractors[] = { &brief_extractor, &orb_extractor };
+    std::string extractor_names[] = { "BRIEF", "ORB" };
+
+    bool passed = true;
+    for (int i = 0; i < 2; ++i) {
+        std::vector<cv::KeyPoint> whole_keypoints, tiled_keypoints;
+        cv::Mat whole_descriptors, tiled_descriptors;
+        detector.detect(img, whole_keypoints);
+        extractors[i]->compute(img, whole_keypoints, whole_descriptors);
+        tiling.detect(&detector, img, cv::Mat(), tiled_keypoints);
+        tiling.compute(extractors[i], img, tiled_keypoints, tiled_descriptors);
+
+        int tiled_found = countFound(tiled_keypoints, tiled_descriptors, whole_keypoints, whole_descriptors, img.size());
+        int whole_found = countFound(whole_keypoints, cv::Mat(), tiled_keypoints, cv::Mat(), img.size());
+        std::stringstream details;
+        details << whole_keypoints.size() << " keypoints in the whole image, " << whole_found << " of them in the tiles; "
+                << tiled_keypoints.size() << " keypoints in the tiles, " << tiled_found << " of them with the same descriptor";
+        passed &= report("tiling FAST/" + extractor_names[i],
+                         !whole_keypoints.empty() &&
+                         whole_found >= MIN_TILING_AGREEMENT * whole_keypoints.size() &&
+                         tiled_found >= MIN_TILING_AGREEMENT * tiled_keypoints.size(),
+                         details.str());
+    }
+    return passed;
+}
+
+// HammingMatcher must find the neighbours at the same distances as BFMatcher(NORM_HAMMING), with and without masks,
+// and when only some of its train images are searched. The indices are not compared, since the ties between equally
+// distant descriptors may be broken differently, except with cross check, where both keep the first one.
+bool SelfTest::checkHammingMatcher() {
+    cv::RNG rng(2);
+    std::vector<cv::Mat> train, queries;
+    for (int i = 0; i < 6; ++i) {
+        train.push_back(createDescriptors(rng, 150 + 50 * i, std::vector<cv::Mat>()));
+    }
+    int n_queries = 0;
+    for (int i = 0; i < 3; ++i) {
+        queries.push_back(createDescriptors(rng, 200, train));
+        n_queries += queries.back().rows;
+    }
+
+    std::stringstream csv;
+    std::stringstream details;
+    details << "2 nearest neighbours of " << n_queries << " queries with the " << HammingMatcher::getKernelName()
+            << " kernel against BFMatcher(NORM_HAMMING), with and without masks, and the nearest neighbour with cross check";
+    bool passed = report("HammingMatcher knnMatch", Benchmark::compareMatchers(train, queries, 1, csv), details.str());
+
+    // the even train images are searched, and BFMatcher only has those
+    std::vector<char> train_images(train.size(), 0);
+    std::vector<cv::Mat> selected;
+    for (unsigned int i = 0; i < train.size(); i += 2) {
+        train_images[i] = 1;
+        selected.push_back(train[i]);
+    }
+    cv::BFMatcher reference(cv::NORM_HAMMING);
+    reference.add(selected);
+    HammingMatcher hamming;
+    hamming.add(train);
+    HammingWorkspace workspace;
+    std::vector<std::vector<cv::DMatch>> expected, found;
+    int mismatches = 0;
+    for (unsigned int i = 0; i < queries.size(); ++i) {
+        reference.knnMatch(queries[i], expected, 2);
+        hamming.knnMatch(queries[i], found, 2, train_images, workspace);
+        for (unsigned int q = 0; q < expected.size(); ++q) {
+            bool same = q < found.size() && expected[q].size() == found[q].size();
+            for (unsigned int j = 0; j < expected[q].size() && same; ++j) {
+                same = expected[q][j].distance == found[q][j].distance && train_images[found[q][j].imgIdx];
+            }
+            if (!same) {
+                ++mismatches;
+            }
+        }
+    }
+    details.str("");
+    details << mismatches << " of " << n_queries << " queries with other neighbours searching " << selected.size()
+            << " of " << train.size() << " train images";
+    passed &= report("HammingMatcher train images", mismatches == 0, details.str());
+    return passed;
+}
+
+// KeypointGrid must remove the same keypoints as cv::pointPolygonTest for random contours: convex and concave
+// quadrilaterals in both orientations, which are tested by QuadRegion, and other polygons, which fall back
+// to pointPolygonTest. The keypoints within CONTOUR_TOLERANCE of an edge are not compared.
+bool SelfTest::checkKeypointGrid() {
+    cv::RNG rng(3);
+    cv::Size size(800, 600);
+    std::vector<cv::KeyPoint> keypoints(3000);
+    for (unsigned int i = 0; i < keypoints.size(); ++i) {
+        keypoints[i].pt = cv::Point2f(rng.uniform(0.0f, (float) size.width), rng.uniform(0.0f, (float) size.height));
+    }
+    KeypointGrid grid;
+    grid.build(keypoints);
+
+    int contours = 200;
+    int mismatches = 0;
+    int removed = 0;
+    KeypointMask active_keypoints;
+    std::vector<cv::Point2f> contour;
+    for (int c = 0; c < contours; ++c) {
+        // the corners around a center at increasing angles, some of them pulled inwards so the contour is concave,
+        // partly outside the image for some of them
+        int corners = c % 5 == 4 ? 3 + c % 3 : 4;
+        cv::Point2f center(rng.uniform(-50.0f, size.width + 50.0f), rng.uniform(-50.0f, size.height + 50.0f));
+        float start = rng.uniform(0.0f, (float) CV_PI);
+        contour.clear();
+        for (int i = 0; i < corners; ++i) {
+            float angle = start + (float) (2 * CV_PI * (i + rng.uniform(0.0f, 0.5f)) / corners);
+            float radius = rng.uniform(c % 3 == 0 ? 20.0f : 100.0f, 250.0f);
+            contour.push_back(center + cv::Point2f(radius * std::cos(angle), radius * std::sin(angle)));
+        }
+        if (c % 2 == 1) {
+            std::reverse(contour.begin(), contour.end());
+        }
+
+        active_keypoints.reset(keypoints.size());
+        grid.removeInside(contour, active_keypoints);
+        for (unsigned int i = 0; i < keypoints.size(); ++i) {
+            double distance = cv::pointPolygonTest(contour, keypoints[i].pt, true);
+            if (std::abs(distance) < CONTOUR_TOLERANCE) {
+                continue;
+            }
+            if (!active_keypoints.isActive(i)) {
+                ++removed;
+            }
+            if ((distance > 0) == active_keypoints.isActive(i)) {
+                ++mismatches;
+            }
+        }
+    }
+
+    std::stringstream details;
+    details << mismatches << " of " << contours * keypoints.size() << " keypoint tests against pointPolygonTest, "
+            << removed << " keypoints removed by " << contours << " contours";
+    return report("KeypointGrid removeInside", mismatches == 0 && removed > 0, details.str());
+}
+
+// HomographyEstimator must find the note at least as well as cv::findHomography with RANSAC, for matches of a note
+// in a scene with noise and from 20% to 60% of outliers. The matches are sorted by a quality that is better for the
+// inliers on average, as the distances of the descriptors are, which is what PROSAC expects.
+bool SelfTest::checkHomographyEstimator() {
+    cv::RNG rng(4);
+    cv::Size note(400, 200);
+    std::vector<cv::Point2f> note_corners;
+    note_corners.push_back(cv::Point2f(0, 0));
+    note_corners.push_back(cv::Point2f((float) note.width, 0));
+    note_corners.push_back(cv::Point2f((float) note.width, (float) note.height));
+    note_corners.push_back(cv::Point2f(0, (float) note.height));
+
+    HomographyEstimator estimator(HOMOGRAPHY_THRESHOLD);
+    int trials = 30;
+    int failures = 0;
+    int estimator_inliers = 0, ransac_inliers = 0;
+    for (int trial = 0; trial < trials; ++trial) {
+        // the note seen in perspective somewhere in a 1000x800 scene
+        std::vector<cv::Point2f> scene_corners;
+        cv::Point2f offset(rng.uniform(100.0f, 500.0f), rng.uniform(100.0f, 500.0f));
+        for (int i = 0; i < 4; ++i) {
+            scene_corners.push_back(offset + note_corners[i] * 0.8f + cv::Point2f(rng.uniform(-40.0f, 40.0f), rng.uniform(-40.0f, 40.0f)));
+        }
+        cv::Mat true_homography = cv::getPerspectiveTransform(note_corners, scene_corners);
+
+        int n_points = 200;
+        double outlier_ratio = 0.2 + 0.4 * trial / (trials - 1);
+        std::vector<std::pair<float, int>> quality(n_points);
+        std::vector<cv::Point2f> src(n_points), dst(n_points), sorted_src, sorted_dst;
+        for (int i = 0; i < n_points; ++i) {
+            src[i] = cv::Point2f(rng.uniform(0.0f, (float) note.width), rng.uniform(0.0f, (float) note.height));
+            bool outlier = i < outlier_ratio * n_points;
+            if (outlier) {
+                dst[i] = cv::Point2f(rng.uniform(0.0f, 1000.0f), rng.uniform(0.0f, 800.0f));
+            } else {
+                std::vector<cv::Point2f> point(1, src[i]), mapped;
+                cv::perspectiveTransform(point, mapped, true_homography);
+                dst[i] = mapped[0] + cv::Point2f((float) rng.gaussian(0.5), (float) rng.gaussian(0.5));
+            }
+            quality[i] = std::make_pair(outlier ? rng.uniform(0.3f, 1.3f) : rng.uniform(0.0f, 1.0f), i);
+        }
+        std::sort(quality.begin(), quality.end());
+        for (int i = 0; i < n_points; ++i) {
+            sorted_src.push_back(src[quality[i].second]);
+            sorted_dst.push_back(dst[quality[i].second]);
+        }
+
+        cv::Mat homography, ransac_homography, ransac_mask;
+        std::vector<int> inliers;
+        bool estimated = estimator.estimate(sorted_src, sorted_dst, homography, inliers);
+        ransac_homography = cv::findHomography(sorted_src, sorted_dst, cv::RANSAC, HOMOGRAPHY_THRESHOLD, ransac_mask);
+        int ransac_count = ransac_homography.empty() ? 0 : cv::countNonZero(ransac_mask);
+        bool ransac_found = ransac_count > 0 && cornerError(ransac_homography, true_homography, note) < HOMOGRAPHY_THRESHOLD;
+        bool found = estimated && cornerError(homography, true_homography, note) < HOMOGRAPHY_THRESHOLD;
+        estimator_inliers += estimated ? (int) inliers.size() : 0;
+        ransac_inliers += ransac_count;
+        if ((ransac_found && !found) || (estimated ? (int) inliers.size() : 0) < MIN_INLIER_RATIO * ransac_count) {
+            ++failures;
+        }
+    }
+
+    std::stringstream details;
+    details << failures << " of " << trials << " notes found worse than findHomography(RANSAC), "
+            << estimator_inliers << " inliers against " << ransac_inliers;
+    return report("HomographyEstimator", failures == 0, details.str());
+}
+
+// The features of a note stored in the FeatureCache must be loaded back unchanged, and must not be loaded
+// for other algorithms, other parameters, a changed image, a truncated file or a damaged header. The note image and the cache
+// files are written in the working directory and removed afterwards.
+bool SelfTest::checkFeatureCache() {
+    FeatureCache cache(".");
+    cv::FastFeatureDetector detector(20);
+    cv::FastFeatureDetector other_detector(30);
+    cv::BriefDescriptorExtractor extractor;
+    cv::OrbDescriptorExtractor other_extractor;
+    std::vector<std::string> failed;
+
+    cv::imwrite(CACHE_NOTE_FILENAME, createTexture(cv::Size(400, 200), 5));
+    NoteImgObject note("SELFTEST", CACHE_NOTE_FILENAME);
+    std::string filename;
+    if (!note.load()) {
+        failed.push_back("write the note");
+    } else {
+        note.compute(&detector, &extractor);
+        cache.store(note, &detector, &extractor);
+        filename = cache.getFilename(note, FeatureCache::computeKey(note, &detector, &extractor));
+
+        NoteImgObject cached("SELFTEST", CACHE_NOTE_FILENAME);
+        cached.load();
+        if (!cache.load(cached, &detector, &extractor) || !sameFeatures(note, cached)) {
+            failed.push_back("round trip");
+        }
+        if (note.getKeypoints().empty()) {
+            failed.push_back("keypoints");
+        }
+        if (cache.load(cached, &detector, &other_extractor)) {
+            failed.push_back("other extractor");
+        }
+        if (cache.load(cached, &other_detector, &extractor)) {
+            failed.push_back("other detector parameters");
+        }
+
+        // a file cut in the middle of the descriptors
+        std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        input.close();
+        std::ofstream truncated(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        truncated.write(contents.data(), contents.size() / 2);
+        truncated.close();
+        if (cache.load(cached, &detector, &extractor)) {
+            failed.push_back("truncated file");
+        }
+
+        // a header whose descriptors would take far more memory than the file holds. The columns follow
+        // the magic number, the version, the key, the hash of the image, the keypoints and the rows.
+        std::string damaged = contents;
+        size_t cols_offset = 2 * sizeof(unsigned int) + 2 * sizeof(uint64) + 2 * sizeof(int);
+        int huge_cols = 1 << 28;
+        if (damaged.size() >= cols_offset + sizeof(huge_cols)) {
+            memcpy(&damaged[cols_offset], &huge_cols, sizeof(huge_cols));
+        }
+        std::ofstream oversized(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        oversized.write(damaged.data(), damaged.size());
+        oversized.close();
+        if (cache.load(cached, &detector, &extractor)) {
+            failed.push_back("damaged header");
+        }
+
+        // the same note with other pixels
+        cache.store(note, &detector, &extractor);
+        cv::imwrite(CACHE_NOTE_FILENAME, createTexture(cv::Size(400, 200), 6));
+        if (cache.load(cached, &detector, &extractor)) {
+            failed.push_back("changed image");
+        }
+    }
+    if (filename != "") {
+        std::remove(filename.c_str());
+    }
+    std::remove(CACHE_NOTE_FILENAME);
+
+    std::stringstream details;
+    details << note.getKeypoints().size() << " keypoints stored and loaded back, ignored for other algorithms, "
+            << "parameters, pixels, a truncated file and a damaged header";
+    for (unsigned int i = 0; i < failed.size(); ++i) {
+        details << (i == 0 ? "; failed: " : ", ") << failed[i];
+    }
+    return report("FeatureCache", failed.empty(), details.str());
+}
+
+// The lines written by JsonSink must be valid JSON, with the quotes, backslashes and control characters of the
+// names escaped and the coordinates that are not finite written as null
+bool SelfTest::checkJson() {
+    std::vector<cv::Point2f> contour;
+    contour.push_back(cv::Point2f(98, 83));
+    contour.push_back(cv::Point2f(1.5f, std::numeric_limits<float>::quiet_NaN()));
+    contour.push_back(cv::Point2f(std::numeric_limits<float>::infinity(), -0.25f));
+    contour.push_back(cv::Point2f(0, 0));
+    std::vector<FoundObject> objects_found;
+    objects_found.push_back(FoundObject(contour, 50, "50\"F\\\n"));
+    objects_found.push_back(FoundObject(std::vector<cv::Point2f>(), 20, "20E\x01"));
+
+    std::stringstream output;
+    JsonSink sink(output);
+    sink.write("dir/a\"b.jpg", cv::Mat(), objects_found);
+    sink.write("empty.jpg", cv::Mat(), std::vector<FoundObject>());
+    sink.writeError("c:\\scenes\\x.jpg", "Unable to read\r\n");
+    sink.close();
+
+    const char* expected[] = {
+        "{\"scene\":\"dir/a\\\"b.jpg\",\"notes\":[{\"tag\":\"50\\\"F\\\\\\u000a\",\"value\":50,"
+            "\"contour\":[[98,83],[1.5,null],[null,-0.25],[0,0]]},{\"tag\":\"20E\\u0001\",\"value\":20,\"contour\":[]}],\"total\":70}",
+        "{\"scene\":\"empty.jpg\",\"notes\":[],\"total\":0}",
+        "{\"scene\":\"c:\\\\scenes\\\\x.jpg\",\"error\":\"Unable to read\\u000d\\u000a\"}"
+    };
+    int lines = sizeof(expected) / sizeof(expected[0]);
+    std::string line;
+    std::stringstream details;
+    int matched = 0;
+    for (int i = 0; i < lines; ++i) {
+        if (!std::getline(output, line) || line != expected[i]) {
+            details << "line " << i + 1 << " is " << line << " instead of " << expected[i] << "; ";
+            continue;
+        }
+        ++matched;
+    }
+    bool extra = (bool) std::getline(output, line);
+    details << matched << " of " << lines << " lines as expected" << (extra ? ", with more lines" : "");
+    return report("JSON output", matched == lines && !extra, details.str());
+}
+
+// Runs all the checks, and tells if all of them passed
+bool SelfTest::run() {
+    failures_ = 0;
+    checkTiling();
+    checkHammingMatcher();
+    checkKeypointGrid();
+    checkHomographyEstimator();
+    checkFeatureCache();
+    checkJson();
+    output_ << (failures_ == 0 ? "All checks passed" : "Some checks failed") << "\n";
+    return failures_ == 0;
+}
@@ -0,0 +1,32 @@
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include <ostream>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+// Checks the parts of the detection that replace an OpenCV implementation with a faster one against that
+// implementation, on synthetic images, so no notes or scenes are needed. Each check writes a line with
+// PASS or FAIL, its name and what was compared.
+class SelfTest {
+private:
+    std::ostream& output_;
+    int failures_;
+
+    bool report(std::string name, bool passed, std::string details);
+    static cv::Mat createTexture(cv::Size size, int seed);
+public:
+    SelfTest(std::ostream& output);
+    ~SelfTest(void);
+
+    bool checkTiling();
+    bool checkHammingMatcher();
+    bool checkKeypointGrid();
+    bool checkHomographyEstimator();
+    bool checkFeatureCache();
+    bool checkJson();
+    bool run();
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "StageTimer.h"
+
+StageTimes::StageTimes(void) {
+    reset();
+}
+
+StageTimes::~StageTimes(void) {}
+
+void StageTimes::reset() {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        ticks_[i] = 0;
+    }
+}
+
+void StageTimes::add(int stage, int64 ticks) {
+    ticks_[stage] += ticks;
+}
+
+double StageTimes::getMilliseconds(int stage) {
+    return ticks_[stage] * 1000.0 / cv::getTickFrequency();
+}
+
+std::string StageTimes::getStageName(int stage) {
+    static const char* names[STAGE_COUNT] = {"imread", "proposal", "detect", "describe", "match", "homography", "removal", "drawing"};
+    return names[stage];
+}
+
+ScopedStageTimer::ScopedStageTimer(StageTimes* times, int stage, Histogram* histogram) :
+    times_(times), stage_(stage), histogram_(histogram), begin_(0) {
+    if (times_ != NULL || histogram_ != NULL) {
+        begin_ = cv::getTickCount();
+    }
+}
+
+ScopedStageTimer::~ScopedStageTimer(void) {
+    if (times_ == NULL && histogram_ == NULL) {
+        return;
+    }
+    int64 ticks = cv::getTickCount() - begin_;
+    if (times_ != NULL) {
+        times_->add(stage_, ticks);
+    }
+    if (histogram_ != NULL) {
+        histogram_->observeTicks(ticks);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <atomic>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+#include "Metrics.h"
+
+// Stages of the detection of the notes in a scene that are timed separately
+enum Stage {
+    STAGE_IMREAD,
+    STAGE_PROPOSAL,
+    STAGE_DETECT,
+    STAGE_DESCRIBE,
+    STAGE_MATCH,
+    STAGE_HOMOGRAPHY,
+    STAGE_REMOVAL,
+    STAGE_DRAWING,
+    STAGE_COUNT
+};
+
+// Time spent in each stage, in ticks of cv::getTickCount. The times can be added from several threads.
+class StageTimes {
+private:
+    std::atomic<int64> ticks_[STAGE_COUNT];
+
+    StageTimes(StageTimes const&);
+    void operator=(StageTimes const&);
+public:
+    StageTimes(void);
+    ~StageTimes(void);
+
+    void reset();
+    void add(int stage, int64 ticks);
+    double getMilliseconds(int stage);
+
+    static std::string getStageName(int stage);
+};
+
+// Adds the time between its construction and its destruction to a stage, and to a latency histogram.
+// Nothing is measured if both times and histogram are NULL.
+class ScopedStageTimer {
+private:
+    StageTimes* times_;
+    int stage_;
+    Histogram* histogram_;
+    int64 begin_;
+public:
+    ScopedStageTimer(StageTimes* times, int stage, Histogram* histogram = NULL);
+    ~ScopedStageTimer(void);
+};
+
+#endif
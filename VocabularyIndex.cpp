@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+#include "VocabularyIndex.h"
+
+#include "Log.h"
+
+// Iterations of the clustering of the descriptors into visual words
+#define TRAIN_ITERATIONS 20
+// Seed of the random initial words, so the same library always gives the same vocabulary
+#define TRAIN_SEED 0x4E4F5445
+// Scene descriptors quantized to score the notes. Quantizing is a search against the whole vocabulary, so a scene
+// with more descriptors is scored with an evenly spaced sample of them, which keeps the score much cheaper than
+// matching the scene against the notes it leaves out.
+#define SCORE_MAX_DESCRIPTORS 256
+
+VocabularyIndex::VocabularyIndex(void) : norm_type_(cv::NORM_L2), notes_(0) {}
+
+VocabularyIndex::~VocabularyIndex(void) {}
+
+// True if there is no vocabulary or the notes are not indexed
+bool VocabularyIndex::empty() const {
+    return vocabulary_.empty() || notes_ == 0;
+}
+
+void VocabularyIndex::clear() {
+    vocabulary_ = cv::Mat();
+    notes_ = 0;
+    idf_.clear();
+    postings_.clear();
+}
+
+// Clusters the descriptors of all the notes into at most the given number of visual words. The binary descriptors
+// (CV_8U) are clustered with k-majority under the Hamming distance, and the others with k-means. The notes must
+// be indexed afterwards. Returns false if there are no descriptors.
+bool VocabularyIndex::train(const std::vector<cv::Mat>& descriptors, int words) {
+    clear();
+    cv::Mat data;
+    for (unsigned int i = 0; i < descriptors.size(); ++i) {
+        if (!descriptors[i].empty()) {
+            data.push_back(descriptors[i]);
+        }
+    }
+    if (data.empty() || words <= 0) {
+        return false;
+    }
+    words = std::min(words, data.rows);
+
+    if (data.type() == CV_8U) {
+        norm_type_ = cv::NORM_HAMMING;
+        vocabulary_ = kMajority(data, words, TRAIN_ITERATIONS);
+    } else {
+        norm_type_ = cv::NORM_L2;
+        if (data.type() != CV_32F) {
+            data.convertTo(data, CV_32F);
+        }
+        cv::Mat labels;
+        cv::kmeans(data, words, labels, cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, TRAIN_ITERATIONS, 1e-3),
+                   3, cv::KMEANS_PP_CENTERS, vocabulary_);
+    }
+    LOG_DEBUG("Vocabulary: " << vocabulary_.rows << " words from " << data.rows << " descriptors\n");
+    return true;
+}
+
+// Clusters binary descriptors: each descriptor is assigned to its nearest word, and each bit of a word
+// is set to the value of most of its descriptors, until the assignments don't change
+cv::Mat VocabularyIndex::kMajority(const cv::Mat& data, int words, int iterations) {
+    cv::RNG rng(TRAIN_SEED);
+    std::vector<int> order(data.rows);
+    for (int i = 0; i < data.rows; ++i) {
+        order[i] = i;
+    }
+    for (int i = data.rows - 1; i > 0; --i) {
+        std::swap(order[i], order[rng.uniform(0, i + 1)]);
+    }
+    cv::Mat centers(words, data.cols, CV_8U);
+    for (int i = 0; i < words; ++i) {
+        data.row(order[i]).copyTo(centers.row(i));
+    }
+
+    int bits = data.cols * 8;
+    cv::Mat distances, nearest;
+    std::vector<int> labels(data.rows, -1);
+    std::vector<int> bit_counts(words * bits);
+    std::vector<int> members(words);
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        cv::batchDistance(data, centers, distances, CV_32S, nearest, cv::NORM_HAMMING, 1);
+        bool changed = false;
+        for (int r = 0; r < data.rows; ++r) {
+            changed = changed || labels[r] != nearest.at<int>(r, 0);
+            labels[r] = nearest.at<int>(r, 0);
+        }
+        if (!changed) {
+            break;
+        }
+
+        std::fill(bit_counts.begin(), bit_counts.end(), 0);
+        std::fill(members.begin(), members.end(), 0);
+        for (int r = 0; r < data.rows; ++r) {
+            int word = labels[r];
+            const uchar* descriptor = data.ptr<uchar>(r);
+            int* counts = &bit_counts[word * bits];
+            ++members[word];
+            for (int b = 0; b < bits; ++b) {
+                counts[b] += (descriptor[b >> 3] >> (b & 7)) & 1;
+            }
+        }
+
+        for (int word = 0; word < words; ++word) {
+            uchar* center = centers.ptr<uchar>(word);
+            // a word without descriptors is moved to a random descriptor
+            if (members[word] == 0) {
+                data.row(rng.uniform(0, data.rows)).copyTo(centers.row(word));
+                continue;
+            }
+            const int* counts = &bit_counts[word * bits];
+            for (int byte = 0; byte < data.cols; ++byte) {
+                uchar value = 0;
+                for (int b = 0; b < 8; ++b) {
+                    if (2 * counts[byte * 8 + b] > members[word]) {
+                        value |= (uchar) (1 << b);
+                    }
+                }
+                center[byte] = value;
+            }
+        }
+    }
+    return centers;
+}
+
+// Writes the vocabulary in a node with the given name
+void VocabularyIndex::write(cv::FileStorage& fs, const std::string& name) const {
+    fs << name << "{" << "norm" << norm_type_ << "words" << vocabulary_ << "}";
+}
+
+// Reads a vocabulary written by write. The notes must be indexed afterwards. Returns false if there is no vocabulary.
+bool VocabularyIndex::read(const cv::FileNode& node) {
+    clear();
+    if (node.empty() || !node.isMap()) {
+        return false;
+    }
+    norm_type_ = (int) node["norm"];
+    cv::read(node["words"], vocabulary_);
+    return !vocabulary_.empty();
+}
+
+// Indexes the descriptors of each note of the library (empty for the notes without them). Returns false if
+// there is no vocabulary or the descriptors are not of the kind of the vocabulary.
+bool VocabularyIndex::index(const std::vector<cv::Mat>& note_descriptors) {
+    notes_ = 0;
+    if (vocabulary_.empty()) {
+        return false;
+    }
+    for (unsigned int i = 0; i < note_descriptors.size(); ++i) {
+        if (!note_descriptors[i].empty() && (note_descriptors[i].cols != vocabulary_.cols ||
+            (note_descriptors[i].type() == CV_8U) != (vocabulary_.type() == CV_8U))) {
+            return false;
+        }
+    }
+
+    int n_words = vocabulary_.rows;
+    int n_notes = (int) note_descriptors.size();
+    std::vector<std::vector<int>> note_words(n_notes);
+    std::vector<int> document_frequency(n_words, 0);
+    std::vector<int> last_note(n_words, -1);
+    for (int i = 0; i < n_notes; ++i) {
+        quantize(note_descriptors[i], note_words[i]);
+        for (unsigned int j = 0; j < note_words[i].size(); ++j) {
+            int word = note_words[i][j];
+            if (last_note[word] != i) {
+                last_note[word] = i;
+                ++document_frequency[word];
+            }
+        }
+    }
+
+    // the words in every note don't tell them apart, so their weight is 0
+    idf_.assign(n_words, 0.0f);
+    for (int word = 0; word < n_words; ++word) {
+        if (document_frequency[word] > 0) {
+            idf_[word] = (float) std::log((double) n_notes / document_frequency[word]);
+        }
+    }
+
+    postings_.assign(n_words, std::vector<Posting>());
+    std::vector<float> weights(n_words);
+    for (int i = 0; i < n_notes; ++i) {
+        if (note_words[i].empty()) {
+            continue;
+        }
+        std::fill(weights.begin(), weights.end(), 0.0f);
+        for (unsigned int j = 0; j < note_words[i].size(); ++j) {
+            weights[note_words[i][j]] += 1;
+        }
+        double norm = 0;
+        for (int word = 0; word < n_words; ++word) {
+            weights[word] *= idf_[word] / note_words[i].size();
+            norm += weights[word] * weights[word];
+        }
+        if (norm <= 0) {
+            continue;
+        }
+        norm = std::sqrt(norm);
+        for (int word = 0; word < n_words; ++word) {
+            if (weights[word] > 0) {
+                postings_[word].push_back(Posting(i, (float) (weights[word] / norm)));
+            }
+        }
+    }
+    notes_ = n_notes;
+    return true;
+}
+
+// Finds the nearest visual word of each descriptor
+void VocabularyIndex::quantize(const cv::Mat& descriptors, std::vector<int>& words) const {
+    words.clear();
+    if (descriptors.empty() || vocabulary_.empty()) {
+        return;
+    }
+
+    cv::Mat distances, nearest;
+    if (norm_type_ == cv::NORM_HAMMING) {
+        cv::batchDistance(descriptors, vocabulary_, distances, CV_32S, nearest, norm_type_, 1);
+    } else if (descriptors.type() != CV_32F) {
+        cv::Mat query;
+        descriptors.convertTo(query, CV_32F);
+        cv::batchDistance(query, vocabulary_, distances, CV_32F, nearest, norm_type_, 1);
+    } else {
+        cv::batchDistance(descriptors, vocabulary_, distances, CV_32F, nearest, norm_type_, 1);
+    }
+
+    words.resize(descriptors.rows);
+    for (int i = 0; i < descriptors.rows; ++i) {
+        words[i] = nearest.at<int>(i, 0);
+    }
+}
+
+// Scores each indexed note against the descriptors of a scene, from 0 (no word in common) to 1. Only the notes
+// that share words with the scene are visited. At most SCORE_MAX_DESCRIPTORS descriptors of the scene are used.
+// words is a buffer for the words of the scene.
+void VocabularyIndex::score(const cv::Mat& descriptors, std::vector<int>& words, std::vector<float>& scores) const {
+    scores.assign(notes_, 0.0f);
+    if (descriptors.rows > SCORE_MAX_DESCRIPTORS) {
+        // every stride-th row of the descriptors, without copying them
+        int stride = (descriptors.rows + SCORE_MAX_DESCRIPTORS - 1) / SCORE_MAX_DESCRIPTORS;
+        int rows = (descriptors.rows + stride - 1) / stride;
+        cv::Mat sample(rows, descriptors.cols, descriptors.type(), descriptors.data, descriptors.step * stride);
+        quantize(sample, words);
+    } else {
+        quantize(descriptors, words);
+    }
+    if (words.empty() || notes_ == 0) {
+        return;
+    }
+
+    // the word histogram of the scene, as runs of the sorted words
+    std::sort(words.begin(), words.end());
+    double norm = 0;
+    for (unsigned int i = 0; i < words.size();) {
+        unsigned int end = i;
+        while (end < words.size() && words[end] == words[i]) {
+            ++end;
+        }
+        int word = words[i];
+        float weight = idf_[word] * (end - i) / words.size();
+        norm += weight * weight;
+        const std::vector<Posting>& postings = postings_[word];
+        for (unsigned int j = 0; j < postings.size(); ++j) {
+            scores[postings[j].note_] += weight * postings[j].weight_;
+        }
+        i = end;
+    }
+    if (norm <= 0) {
+        return;
+    }
+    norm = std::sqrt(norm);
+    for (int i = 0; i < notes_; ++i) {
+        scores[i] = (float) (scores[i] / norm);
+    }
+}
+
+// Name of the node of the vocabulary for the descriptors of the given algorithms
+std::string VocabularyIndex::getNodeName(cv::Algorithm* detector, cv::Algorithm* extractor) {
+    std::string name = "vocabulary_" + detector->name() + "_" + extractor->name();
+    for (unsigned int i = 0; i < name.size(); ++i) {
+        if (!isalnum((unsigned char) name[i])) {
+            name[i] = '_';
+        }
+    }
+    return name;
+}
@@ -0,0 +1,46 @@
+#ifndef VOCABULARY_INDEX_H
+#define VOCABULARY_INDEX_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+// Bag of visual words index of the notes of a library. Each descriptor is quantized to its nearest visual word,
+// and the notes are scored against a scene by the cosine of their tf-idf weighted word histograms, using an
+// inverted index from each word to the notes that have it. The vocabulary is trained offline from the library
+// descriptors, with k-means for float descriptors and k-majority for binary ones, and stored with FileStorage.
+class VocabularyIndex {
+private:
+    struct Posting {
+        Posting(int note, float weight) : note_(note), weight_(weight) {};
+        int note_;
+        float weight_;
+    };
+
+    // one visual word per row, of the same type as the descriptors
+    cv::Mat vocabulary_;
+    int norm_type_;
+    int notes_;
+    std::vector<float> idf_;
+    std::vector<std::vector<Posting>> postings_;
+
+    static cv::Mat kMajority(const cv::Mat& data, int words, int iterations);
+public:
+    VocabularyIndex(void);
+    ~VocabularyIndex(void);
+
+    bool empty() const;
+    void clear();
+    bool train(const std::vector<cv::Mat>& descriptors, int words);
+    void write(cv::FileStorage& fs, const std::string& name) const;
+    bool read(const cv::FileNode& node);
+
+    bool index(const std::vector<cv::Mat>& note_descriptors);
+    void quantize(const cv::Mat& descriptors, std::vector<int>& words) const;
+    void score(const cv::Mat& descriptors, std::vector<int>& words, std::vector<float>& scores) const;
+
+    static std::string getNodeName(cv::Algorithm* detector, cv::Algorithm* extractor);
+};
+
+#endif